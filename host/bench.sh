@@ -0,0 +1,29 @@
+#!/usr/bin/env bash
+# Run mfs-bench over directory sizes from 1k to 1M entries, each on a fresh
+# scratch image, and collect the records in one file.
+#
+#   MKFS    mkfs for MFS images (nbmkfs.mfs from the MINIX tools build)
+#   SIZES   directory sizes to run
+#   FORMAT  json or csv
+#   OUT     where the records go
+set -e
+cd "$(dirname "$0")"
+
+MKFS=${MKFS:-nbmkfs.mfs}
+SIZES=${SIZES:-"1000 10000 100000 1000000"}
+FORMAT=${FORMAT:-json}
+OUT=${OUT:-bench-$(date +%Y%m%d-%H%M%S).${FORMAT}}
+IMG=${IMG:-scratch.img}
+
+: > "$OUT"
+for n in $SIZES; do
+	# An inode per entry and a few spare; links and renames take none.
+	inodes=$((n + 1024))
+	blocks=$((n / 16 + 65536))
+	rm -f "$IMG"
+	truncate -s $((blocks * 4096)) "$IMG"
+	"$MKFS" -B 4096 -b $blocks -i $inodes "$IMG" > /dev/null
+	./mfs-bench -n "$n" -f "$FORMAT" "$IMG" "$@" >> "$OUT"
+done
+rm -f "$IMG"
+echo "results in $OUT"
@@ -0,0 +1,338 @@
+/* This file is the host stand-in for the block device driver and for the
+ * libminixfs buffer cache.  Blocks come from an image file opened by
+ * host_dev_attach(); the cache is a plain hash table with an LRU list of
+ * unused buffers, written back on eviction and on lmfs_flushall().
+ *
+ * The entry points into this file are
+ *   host_dev_attach: make an open image file the device
+ *   bdev_*:          the block device calls MFS makes directly
+ *   lmfs_*:          the buffer cache calls MFS makes
+ */
+
+#include <sys/types.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <minix/const.h>
+#include <minix/type.h>
+#include <minix/ipc.h>
+#include <minix/sysutil.h>
+#include <minix/bdev.h>
+#include <minix/libminixfs.h>
+
+#include "mfs_host.h"
+
+#define NR_HASH		1024	/* buckets, a power of two */
+#define DEFAULT_BUFS	4096	/* buffers unless lmfs_buf_pool says else */
+
+static int dev_fd = -1;		/* image file */
+static dev_t dev_nr = NO_DEV;	/* device number MFS knows it by */
+
+static int block_size = 0;	/* 0 until lmfs_set_blocksize */
+static int nr_bufs = DEFAULT_BUFS;
+static struct buf *bufs;	/* all buffers, nr_bufs of them */
+static LIST_HEAD(, buf) hash[NR_HASH];
+static TAILQ_HEAD(, buf) lru = TAILQ_HEAD_INITIALIZER(lru);
+static int rdwt_err = OK;
+
+uint64_t host_blocks_read, host_blocks_written;
+
+static void buf_alloc(void);
+static void buf_free(void);
+static void buf_write(struct buf *bp);
+static int buf_read(struct buf *bp);
+
+#define HASH(b)		((b) & (NR_HASH - 1))
+
+/*===========================================================================*
+ *				host_dev_attach				     *
+ *===========================================================================*/
+void host_dev_attach(
+  dev_t dev,			/* device number to use */
+  int fd			/* open image file */
+)
+{
+  dev_nr = dev;
+  dev_fd = fd;
+  host_blocks_read = host_blocks_written = 0;
+}
+
+/*===========================================================================*
+ *				bdev_*					     *
+ *===========================================================================*/
+void bdev_driver(dev_t dev, char *label)
+{
+}
+
+int bdev_open(dev_t dev, int access)
+{
+  return(dev == dev_nr && dev_fd >= 0 ? OK : ENXIO);
+}
+
+int bdev_close(dev_t dev)
+{
+  return(dev == dev_nr ? OK : ENXIO);
+}
+
+ssize_t bdev_read(dev_t dev, u64_t pos, char *buf, size_t count, int flags)
+{
+  ssize_t r;
+
+  if (dev != dev_nr) return(-ENXIO);
+  r = pread(dev_fd, buf, count, (off_t) pos);
+  if (r < 0) return(-errno);
+  if ((size_t) r < count) memset(buf + r, 0, count - r);
+  return((ssize_t) count);
+}
+
+ssize_t bdev_write(dev_t dev, u64_t pos, char *buf, size_t count, int flags)
+{
+  ssize_t r;
+
+  if (dev != dev_nr) return(-ENXIO);
+  r = pwrite(dev_fd, buf, count, (off_t) pos);
+  return(r < 0 ? -errno : r);
+}
+
+/*===========================================================================*
+ *				buf_alloc				     *
+ *===========================================================================*/
+static void buf_alloc(void)
+{
+/* (Re)build the pool for the current block size and buffer count. */
+  struct buf *bp;
+  int i;
+
+  buf_free();
+  if ((bufs = calloc(nr_bufs, sizeof(*bufs))) == NULL)
+	panic("host: no memory for %d buffers", nr_bufs);
+
+  for (i = 0; i < NR_HASH; i++) LIST_INIT(&hash[i]);
+  TAILQ_INIT(&lru);
+
+  for (bp = bufs; bp < &bufs[nr_bufs]; bp++) {
+	if ((bp->data = malloc(block_size)) == NULL)
+		panic("host: no memory for buffer data");
+	bp->lmfs_bytes = block_size;
+	bp->lmfs_dev = NO_DEV;
+	TAILQ_INSERT_TAIL(&lru, bp, lmfs_lru);
+  }
+}
+
+/*===========================================================================*
+ *				buf_free				     *
+ *===========================================================================*/
+static void buf_free(void)
+{
+  int i;
+
+  if (bufs == NULL) return;
+  lmfs_flushall();
+  for (i = 0; i < nr_bufs; i++) free(bufs[i].data);
+  free(bufs);
+  bufs = NULL;
+}
+
+/*===========================================================================*
+ *				buf_read				     *
+ *===========================================================================*/
+static int buf_read(struct buf *bp)
+{
+  ssize_t r;
+
+  r = bdev_read(bp->lmfs_dev, (u64_t) bp->lmfs_blocknr * block_size,
+	bp->data, block_size, BDEV_NOFLAGS);
+  if (r != block_size) {
+	rdwt_err = (r < 0 ? (int) -r : EIO);
+	return(rdwt_err);
+  }
+  host_blocks_read++;
+  return(OK);
+}
+
+/*===========================================================================*
+ *				buf_write				     *
+ *===========================================================================*/
+static void buf_write(struct buf *bp)
+{
+  ssize_t r;
+
+  if (bp->lmfs_dirt != BP_DIRTY || bp->lmfs_dev == NO_DEV) return;
+
+  r = bdev_write(bp->lmfs_dev, (u64_t) bp->lmfs_blocknr * block_size,
+	bp->data, block_size, BDEV_NOFLAGS);
+  if (r != block_size) {
+	rdwt_err = (r < 0 ? (int) -r : EIO);
+	return;
+  }
+  host_blocks_written++;
+  bp->lmfs_dirt = BP_CLEAN;
+}
+
+/*===========================================================================*
+ *				lmfs_get_block				     *
+ *===========================================================================*/
+struct buf *lmfs_get_block(
+  dev_t dev,			/* on which device is the block? */
+  block_t block,		/* which block is wanted? */
+  int only_search		/* NORMAL, NO_READ or PREFETCH */
+)
+{
+  struct buf *bp;
+
+  assert(bufs != NULL);
+
+  LIST_FOREACH(bp, &hash[HASH(block)], lmfs_hash) {
+	if (bp->lmfs_blocknr == block && bp->lmfs_dev == dev) {
+		if (bp->lmfs_count++ == 0)
+			TAILQ_REMOVE(&lru, bp, lmfs_lru);
+		return(bp);
+	}
+  }
+
+  /* Not cached: take the least recently used free buffer. */
+  if ((bp = TAILQ_FIRST(&lru)) == NULL)
+	panic("host: all %d buffers in use", nr_bufs);
+  TAILQ_REMOVE(&lru, bp, lmfs_lru);
+  buf_write(bp);
+  if (bp->lmfs_dev != NO_DEV) LIST_REMOVE(bp, lmfs_hash);
+
+  bp->lmfs_dev = dev;
+  bp->lmfs_blocknr = block;
+  bp->lmfs_count = 1;
+  bp->lmfs_dirt = BP_CLEAN;
+  LIST_INSERT_HEAD(&hash[HASH(block)], bp, lmfs_hash);
+
+  if (only_search != NO_READ && buf_read(bp) != OK)
+	memset(bp->data, 0, block_size);
+
+  return(bp);
+}
+
+struct buf *lmfs_get_block_ino(dev_t dev, block_t block, int only_search,
+	ino_t ino, u64_t off)
+{
+  return(lmfs_get_block(dev, block, only_search));
+}
+
+/*===========================================================================*
+ *				lmfs_put_block				     *
+ *===========================================================================*/
+void lmfs_put_block(
+  struct buf *bp,		/* pointer to the buffer to be released */
+  int block_type		/* INODE_BLOCK, DIRECTORY_BLOCK, or whatever */
+)
+{
+  if (bp == NULL) return;
+
+  assert(bp->lmfs_count > 0);
+  if (--bp->lmfs_count == 0)
+	TAILQ_INSERT_TAIL(&lru, bp, lmfs_lru);
+}
+
+void lmfs_markdirty(struct buf *bp)
+{
+  bp->lmfs_dirt = BP_DIRTY;
+}
+
+void lmfs_markclean(struct buf *bp)
+{
+  bp->lmfs_dirt = BP_CLEAN;
+}
+
+int lmfs_isclean(struct buf *bp)
+{
+  return(bp->lmfs_dirt == BP_CLEAN);
+}
+
+dev_t lmfs_dev(struct buf *bp)
+{
+  return(bp->lmfs_dev);
+}
+
+int lmfs_bytes(struct buf *bp)
+{
+  return(bp->lmfs_bytes);
+}
+
+int lmfs_fs_block_size(void)
+{
+  return(block_size);
+}
+
+/*===========================================================================*
+ *				lmfs_set_blocksize			     *
+ *===========================================================================*/
+void lmfs_set_blocksize(int new_block_size, int major)
+{
+  if (new_block_size == block_size && bufs != NULL) return;
+  buf_free();
+  block_size = new_block_size;
+  buf_alloc();
+}
+
+/*===========================================================================*
+ *				lmfs_buf_pool				     *
+ *===========================================================================*/
+void lmfs_buf_pool(int new_nr_bufs)
+{
+  if (new_nr_bufs <= 0) new_nr_bufs = DEFAULT_BUFS;
+  if (new_nr_bufs == nr_bufs && bufs != NULL) return;
+  buf_free();
+  nr_bufs = new_nr_bufs;
+  if (block_size > 0) buf_alloc();
+}
+
+/*===========================================================================*
+ *				lmfs_flushall				     *
+ *===========================================================================*/
+void lmfs_flushall(void)
+{
+  int i;
+
+  if (bufs == NULL) return;
+  for (i = 0; i < nr_bufs; i++) buf_write(&bufs[i]);
+  if (dev_fd >= 0) fsync(dev_fd);
+}
+
+/*===========================================================================*
+ *				lmfs_invalidate				     *
+ *===========================================================================*/
+void lmfs_invalidate(dev_t device)
+{
+/* Drop every unused block of the device, without writing it back. */
+  int i;
+
+  if (bufs == NULL) return;
+  for (i = 0; i < nr_bufs; i++) {
+	if (bufs[i].lmfs_dev != device || bufs[i].lmfs_count > 0) continue;
+	LIST_REMOVE(&bufs[i], lmfs_hash);
+	bufs[i].lmfs_dev = NO_DEV;
+	bufs[i].lmfs_dirt = BP_CLEAN;
+  }
+}
+
+void lmfs_rw_scattered(dev_t dev, struct buf **bufq, int bufqsize,
+	int rw_flag)
+{
+/* No gathering on the host: one block at a time. */
+  int i;
+
+  for (i = 0; i < bufqsize; i++) {
+	if (rw_flag == WRITING) buf_write(bufq[i]);
+	else if (buf_read(bufq[i]) != OK) memset(bufq[i]->data, 0, block_size);
+  }
+}
+
+/* Hooks for the VM-backed cache MINIX has and the host does not. */
+void lmfs_blockschange(dev_t dev, int delta) { }
+void lmfs_zero_block_ino(dev_t dev, ino_t ino, u64_t off) { }
+void lmfs_cache_reevaluate(dev_t dev) { }
+void lmfs_may_use_vmcache(int ok) { }
+void lmfs_setquiet(int q) { }
+int lmfs_do_bpeek(message *m) { return(ENOSYS); }
+void lmfs_reset_rdwt_err(void) { rdwt_err = OK; }
+int lmfs_rdwt_err(void) { return(rdwt_err); }
@@ -0,0 +1,278 @@
+#!/usr/bin/env bash
+# Regression checks for the MFS requests, run through mfs-host on a scratch
+# image.  Every mfs-host run is a mount of its own, so a check that needs the
+# caches of one mount feeds its commands on stdin (script).  Prints a line
+# per failed check and exits 1 if there was one.
+#
+#   MKFS    mkfs for MFS images (nbmkfs.mfs from the MINIX tools build)
+set -u
+cd "$(dirname "$0")"
+
+MKFS=${MKFS:-nbmkfs.mfs}
+IMG=${IMG:-check.img}
+failed=0
+
+fail() {
+	echo "FAIL: $*"
+	failed=1
+}
+
+# A new, empty file system.
+fresh() {
+	rm -f "$IMG"
+	truncate -s $((16384 * 4096)) "$IMG"
+	"$MKFS" -B 4096 -b 16384 -i 4096 "$IMG" > /dev/null
+}
+
+# ok command [arg ...]: the command works.
+ok() {
+	local out
+	out=$(./mfs-host "$IMG" "$@" 2>&1) || fail "$*: $out"
+}
+
+# err message command [arg ...]: the command fails with that message.
+err() {
+	local msg=$1 out
+	shift
+	if out=$(./mfs-host "$IMG" "$@" 2>&1) || [[ $out != *"$msg"* ]]; then
+		fail "$* should fail with '$msg': $out"
+	fi
+}
+
+# says text command [arg ...]: the command works and prints text.
+says() {
+	local text=$1 out
+	shift
+	out=$(./mfs-host "$IMG" "$@" 2>&1)
+	[[ $? -eq 0 && $out == *"$text"* ]] || fail "$* should say '$text': $out"
+}
+
+# script want: the commands on stdin, in one mount, print just want.
+script() {
+	local want=$1 out
+	out=$(./mfs-host "$IMG" - 2>&1)
+	[[ $out == "$want" ]] || fail "script should print '$want': $out"
+}
+
+# is path field value: stat shows that value for the field.
+is() {
+	local got
+	got=$(./mfs-host "$IMG" stat "$1" 2>&1 |
+	    sed -n "s/.* $2 \([^ ]*\).*/\1/p")
+	[[ $got == "$3" ]] || fail "$1: $2 is '$got', not '$3'"
+}
+
+there() {
+	ok stat "$1"
+}
+
+gone() {
+	err "No such file" stat "$1"
+}
+
+ino() {
+	./mfs-host "$IMG" stat "$1" 2>/dev/null |
+	    sed -n 's/.* ino \([0-9]*\) .*/\1/p'
+}
+
+# Rename flags: NOREPLACE is tested before the type of the target, and
+# EXCHANGE swaps two names, fixing up ".." and link counts for directories.
+fresh
+ok mkdir d
+ok create a
+ok create b
+err "File exists" rename a b noreplace
+ok rename a c noreplace
+gone a
+there c
+err "File exists" rename b d noreplace
+err "File exists" rename d b noreplace
+err "Is a directory" rename b d
+err "No such file" rename c none exchange
+b=$(ino b)
+c=$(ino c)
+ok rename b c exchange
+is b ino "$c"
+is c ino "$b"
+ok mkdir e
+ok create e/f
+ok rename d e/f exchange
+is e/f mode 40755
+is d mode 100644
+is e nlink 3
+is / nlink 3
+ok rmdir e/f
+is e nlink 2
+ok rename b c
+gone b
+
+# Deletion modes: A refuses, B needs two unlinks, C keeps a .bak first.  A
+# .mode file wins over an .rmode file further up, and a mode goes away with
+# its file, also for a directory below the depth the walk up caches at.
+fresh
+ok mkdir a
+ok create a/f
+ok create a/A.mode
+err "Operation not permitted" unlink a/f
+ok unlink a/A.mode
+ok unlink a/f
+ok mkdir b
+ok create b/f
+ok create b/B.mode
+err "Operation now in progress" unlink b/f
+there b/f
+ok unlink b/f
+gone b/f
+ok mkdir c
+ok create c/f
+ok create c/C.mode
+ok unlink c/f
+gone c/f
+there c/f.bak
+ok unlink c/f.bak
+gone c/f.bak
+ok mkdir r
+ok create r/A.rmode
+ok mkdir r/s
+ok create r/s/f
+err "Operation not permitted" unlink r/s/f
+ok create r/s/C.mode
+ok unlink r/s/f
+there r/s/f.bak
+script "mfs-host: unlink: Operation not permitted" <<EOF
+create r/s/g
+unlink r/s/C.mode
+unlink r/s/g
+unlink r/A.rmode
+unlink r/s/g
+EOF
+gone r/s/g
+deep=r
+for i in $(seq 40); do deep=$deep/x; done
+script "mfs-host: unlink: Operation now in progress
+mfs-host: unlink: Operation not permitted" < <(
+	p=r
+	for i in $(seq 40); do p=$p/x; echo "mkdir $p"; done
+	echo "create r/B.rmode"
+	echo "create $deep/f"
+	echo "unlink $deep/f"
+	echo "unlink r/B.rmode"
+	echo "create r/A.rmode"
+	echo "unlink $deep/f"
+	echo "unlink r/A.rmode"
+	echo "unlink $deep/f"
+)
+gone "$deep/f"
+
+# Unlinking under an .rmode file moves the directory's times, which must not
+# look like a mode change: mode_gen stays where the first unlink left it.
+# The pauses make every unlink land in a new second.
+fresh
+ok mkdir m
+ok create m/C.rmode
+ok mkdir m/s
+for i in 1 2 3; do ok create m/s/f$i; done
+out=$(./mfs-host "$IMG" - 2>&1 < <(
+	echo "unlink m/s/f1"
+	echo "modegen"
+	for f in f1.bak f2 f2.bak f3 f3.bak; do
+		sleep 1.1
+		echo "unlink m/s/$f"
+	done
+	echo "modegen"
+))
+first=${out%%$'\n'*}
+[[ $first == "mode_gen "* && $out == "$first"$'\n'"$first" ]] ||
+    fail "unlinks under an .rmode file changed mode_gen: $out"
+for i in 1 2 3; do gone m/s/f$i; gone m/s/f$i.bak; done
+
+# rmtree: a whole tree goes in one request, files first; deletion modes
+# apply to the files as unlink would, and what they keep keeps its
+# directory.  Past MFS_RMTREE_KEPT_MAX .bak files the walk stops, ENOSPC.
+fresh
+ok mkdir t
+ok mkdir t/u
+ok create t/u/f
+ok mkdir t/u/v
+ok create t/g
+says "removed 5 kept 0 failed 0" rmtree t
+gone t
+ok create h
+says "removed 1 kept 0 failed 0" rmtree h
+gone h
+ok mkdir k
+ok create k/f
+ok create k/A.mode
+ok mkdir k/c
+ok create k/c/f
+ok create k/c/C.mode
+says "removed 2 kept 2 failed 0" rmtree k
+there k/f
+gone k/A.mode
+there k/c/f.bak
+gone k/c/C.mode
+err "No such file" rmtree none
+ok mkdir full
+script "" < <(
+	for i in $(seq 0 1029); do echo "create full/f$i"; done
+	echo "create full/C.mode"
+)
+script "removed 0 kept 1023 failed 8
+mfs-host: rmtree: No space left on device" <<<"rmtree full"
+there full/f1022.bak
+there full/f1023
+there full/C.mode
+
+# copytree: a new tree with its own inodes, the data and the link counts of
+# the original; it may not go over an existing name or into itself.
+fresh
+ok mkdir s
+ok create s/f
+ok write s/f hello
+ok mkdir s/d
+ok create s/d/g
+says "copied 4 failed 0" copytree s s2
+is s2/f size 5
+is s2/d nlink 2
+is s2 nlink 3
+is / nlink 4
+there s2/d/g
+[[ $(ino s2/f) != "$(ino s/f)" ]] || fail "s2/f is s/f"
+err "File exists" copytree s s2
+err "Invalid argument" copytree s s/d/in
+gone s/d/in
+says "copied 1 failed 0" copytree s/f f2
+is f2 size 5
+is s/f nlink 1
+
+# Journal: with /.journal in place, an inode number the log still mentions
+# is not handed out again in the same mount, the requests answered before a
+# crash that loses the caches are all there after the next mount, and
+# compaction, which is not logged, is refused.
+fresh
+ok create .journal
+ok fill .journal 262144
+ok create a
+ok create b
+ok create x
+ok mkdir d
+x=$(ino x)
+y=$(printf 'unlink x\ncreate y\nstat y\n' | ./mfs-host "$IMG" - 2>&1 |
+    sed -n 's/.* ino \([0-9]*\) .*/\1/p')
+[[ -n $y && $y != "$x" ]] || fail "y got the number of x ($x): '$y'"
+script "" <<EOF
+rename a d/a
+link b d/b
+unlink b
+unlink y
+crash
+EOF
+gone a
+there d/a
+gone b
+is d/b nlink 1
+gone y
+err "Device or resource busy" compact d
+
+rm -f "$IMG"
+exit $failed
@@ -0,0 +1,55 @@
+/* Forced into every compilation unit of the host build (see Makefile).
+ * MINIX gets these from its own libc headers: the NetBSD <sys/cdefs.h>
+ * extensions and the MINIX additions to <sys/types.h>.  The host libc has
+ * none of them.
+ */
+#ifndef _HOST_COMPAT_H
+#define _HOST_COMPAT_H
+
+#include <sys/cdefs.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifndef __printflike
+#define __printflike(a, b)	__attribute__((__format__(__printf__, a, b)))
+#endif
+#ifndef __dead
+#define __dead			__attribute__((__noreturn__))
+#endif
+#ifndef __packed
+#define __packed		__attribute__((__packed__))
+#endif
+#ifndef __aligned
+#define __aligned(x)		__attribute__((__aligned__(x)))
+#endif
+#ifndef __UNCONST
+#define __UNCONST(a)		((void *)(unsigned long)(const void *)(a))
+#endif
+#ifndef __arraycount
+#define __arraycount(a)		(sizeof(a) / sizeof(a[0]))
+#endif
+
+/* NetBSD names of the struct stat time fields. */
+#define st_atimespec		st_atim
+#define st_mtimespec		st_mtim
+#define st_ctimespec		st_ctim
+
+typedef uint8_t		u8_t;
+typedef uint16_t	u16_t;
+typedef uint32_t	u32_t;
+typedef uint64_t	u64_t;
+typedef int8_t		i8_t;
+typedef int16_t		i16_t;
+typedef int32_t		i32_t;
+typedef int64_t		i64_t;
+
+typedef uint32_t	zone_t;
+typedef uint32_t	block_t;
+typedef uint32_t	bit_t;
+typedef uint32_t	bitchunk_t;
+typedef int		endpoint_t;
+typedef int32_t		cp_grant_id_t;
+typedef unsigned long	vir_bytes;
+typedef unsigned long	phys_bytes;
+
+#endif /* _HOST_COMPAT_H */
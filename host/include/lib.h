@@ -0,0 +1,36 @@
+/* Host stand-in for MINIX's <lib.h>: the headers it pulls in, without the
+ * system call glue, plus the MINIX-only error codes the host <errno.h> lacks.
+ */
+#ifndef _HOST_LIB_H
+#define _HOST_LIB_H
+
+#include <minix/config.h>
+#include <sys/types.h>
+#include <limits.h>
+#include <errno.h>
+
+#include <minix/const.h>
+#include <minix/com.h>
+#include <minix/type.h>
+#include <minix/ipc.h>
+
+#ifndef EGENERIC
+#define EGENERIC	99	/* generic error */
+#endif
+#ifndef EBADREQUEST
+#define EBADREQUEST	107	/* destination cannot handle request */
+#endif
+#ifndef EDONTREPLY
+#define EDONTREPLY	201	/* pseudo-code: don't send a reply */
+#endif
+#ifndef EENTERMOUNT
+#define EENTERMOUNT	301	/* need to go under a mount point */
+#endif
+#ifndef ELEAVEMOUNT
+#define ELEAVEMOUNT	302	/* need to go over a mount point */
+#endif
+#ifndef ESYMLINK
+#define ESYMLINK	303	/* need to follow a symbolic link */
+#endif
+
+#endif /* _HOST_LIB_H */
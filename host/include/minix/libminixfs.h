@@ -0,0 +1,67 @@
+/* Host stand-in for <minix/libminixfs.h>.  The buffer cache is the one in
+ * blockdev.c, on top of an image file; only what MFS uses is declared.
+ */
+#ifndef _HOST_LIBMINIXFS_H
+#define _HOST_LIBMINIXFS_H
+
+#include <sys/queue.h>
+#include <minix/safecopies.h>
+#include <minix/sef.h>
+
+struct buf {
+  /* Data portion of the buffer. */
+  void *data;
+
+  /* Header portion of the buffer, internal to blockdev.c. */
+  LIST_ENTRY(buf) lmfs_hash;	/* hash chain */
+  TAILQ_ENTRY(buf) lmfs_lru;	/* unused buffers, least recent first */
+  block_t lmfs_blocknr;		/* block number of its (minor) device */
+  dev_t lmfs_dev;		/* major | minor device where block resides */
+  int lmfs_count;		/* number of users of this buffer */
+  int lmfs_dirt;		/* BP_CLEAN or BP_DIRTY */
+  unsigned int lmfs_bytes;	/* number of bytes allocated in data */
+};
+
+#define BP_CLEAN	0
+#define BP_DIRTY	1
+
+#ifndef b_data
+#define b_data(bp)	((char *) (bp)->data)
+#endif
+#ifndef MARKDIRTY
+#define MARKDIRTY(b)	lmfs_markdirty(b)
+#define MARKCLEAN(b)	lmfs_markclean(b)
+#define ISDIRTY(b)	(!lmfs_isclean(b))
+#define ISCLEAN(b)	lmfs_isclean(b)
+#endif
+#ifndef get_block
+#define get_block(d, b, t)	lmfs_get_block(d, b, t)
+#define put_block(b, t)		lmfs_put_block(b, t)
+#endif
+
+struct buf *lmfs_get_block(dev_t dev, block_t block, int only_search);
+struct buf *lmfs_get_block_ino(dev_t dev, block_t block, int only_search,
+	ino_t ino, u64_t off);
+void lmfs_put_block(struct buf *bp, int block_type);
+void lmfs_markdirty(struct buf *bp);
+void lmfs_markclean(struct buf *bp);
+int lmfs_isclean(struct buf *bp);
+dev_t lmfs_dev(struct buf *bp);
+int lmfs_bytes(struct buf *bp);
+int lmfs_fs_block_size(void);
+void lmfs_set_blocksize(int blocksize, int major);
+void lmfs_blockschange(dev_t dev, int delta);
+void lmfs_buf_pool(int new_nr_bufs);
+void lmfs_flushall(void);
+void lmfs_invalidate(dev_t device);
+void lmfs_rw_scattered(dev_t dev, struct buf **bufq, int bufqsize,
+	int rw_flag);
+void lmfs_zero_block_ino(dev_t dev, ino_t ino, u64_t off);
+void lmfs_cache_reevaluate(dev_t dev);
+void lmfs_may_use_vmcache(int ok);
+void lmfs_setquiet(int q);
+int lmfs_do_bpeek(message *m);
+void lmfs_reset_rdwt_err(void);
+int lmfs_rdwt_err(void);
+
+#endif /* _HOST_LIBMINIXFS_H */
@@ -0,0 +1,160 @@
+/* This file is the host stand-in for the parts of libsys MFS calls: safe
+ * copies through grants, the clock, and panic.  A grant is just a slot that
+ * remembers a buffer in the (single) address space; VFS and MFS are the same
+ * process on the host.
+ *
+ * The entry points into this file are
+ *   host_grant:       make a grant for a buffer
+ *   host_ungrant:     revoke all grants
+ *   sys_safecopy*:    copy to or from a granted buffer
+ *   getuptime etc.:   the clock, in HOST_HZ ticks since the first call
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <minix/const.h>
+#include <minix/type.h>
+#include <minix/ipc.h>
+#include <minix/syslib.h>
+#include <minix/sysutil.h>
+
+#include "mfs_host.h"
+
+#define NR_GRANTS	16	/* at most this many per request */
+#define HOST_HZ		1000	/* clock ticks per second */
+
+static struct {
+  char *g_addr;
+  size_t g_len;
+} grants[NR_GRANTS];
+static int nr_grants = 0;
+
+static struct timespec boot;	/* time of the first clock call */
+
+/*===========================================================================*
+ *				host_grant				     *
+ *===========================================================================*/
+int host_grant(
+  void *addr,			/* start of the buffer */
+  size_t len			/* its size */
+)
+{
+  if (nr_grants == NR_GRANTS) panic("host: out of grants");
+  grants[nr_grants].g_addr = addr;
+  grants[nr_grants].g_len = len;
+  return(nr_grants++);
+}
+
+/*===========================================================================*
+ *				host_ungrant				     *
+ *===========================================================================*/
+void host_ungrant(void)
+{
+  nr_grants = 0;
+}
+
+/*===========================================================================*
+ *				grant_check				     *
+ *===========================================================================*/
+static char *grant_check(cp_grant_id_t grant, vir_bytes offset, size_t bytes)
+{
+  if (grant < 0 || grant >= nr_grants) return(NULL);
+  if (offset > grants[grant].g_len || bytes > grants[grant].g_len - offset)
+	return(NULL);
+  return(grants[grant].g_addr + offset);
+}
+
+/*===========================================================================*
+ *				sys_safecopyfrom			     *
+ *===========================================================================*/
+int sys_safecopyfrom(endpoint_t src_e, cp_grant_id_t grant,
+	vir_bytes offset, vir_bytes address, size_t bytes)
+{
+  char *p;
+
+  if ((p = grant_check(grant, offset, bytes)) == NULL) return(EPERM);
+  memcpy((void *) address, p, bytes);
+  return(OK);
+}
+
+/*===========================================================================*
+ *				sys_safecopyto				     *
+ *===========================================================================*/
+int sys_safecopyto(endpoint_t dst_e, cp_grant_id_t grant,
+	vir_bytes offset, vir_bytes address, size_t bytes)
+{
+  char *p;
+
+  if ((p = grant_check(grant, offset, bytes)) == NULL) return(EPERM);
+  memcpy(p, (void *) address, bytes);
+  return(OK);
+}
+
+/*===========================================================================*
+ *				getuptime				     *
+ *===========================================================================*/
+int getuptime(clock_t *ticks, clock_t *realtime, time_t *boottime)
+{
+/* MFS computes the time of day as boottime + realtime / sys_hz(). */
+  struct timespec now;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  if (boot.tv_sec == 0) boot = now;
+
+  if (ticks != NULL || realtime != NULL) {
+	clock_t t = (clock_t) ((now.tv_sec - boot.tv_sec) * HOST_HZ +
+		(now.tv_nsec - boot.tv_nsec) / (1000000000 / HOST_HZ));
+	if (ticks != NULL) *ticks = t;
+	if (realtime != NULL) *realtime = t;
+  }
+  if (boottime != NULL) *boottime = boot.tv_sec;
+  return(OK);
+}
+
+u32_t sys_hz(void)
+{
+  return(HOST_HZ);
+}
+
+void read_tsc_64(u64_t *t)
+{
+  *t = __builtin_ia32_rdtsc();
+}
+
+/*===========================================================================*
+ *				panic					     *
+ *===========================================================================*/
+void panic(const char *fmt, ...)
+{
+  va_list args;
+
+  fprintf(stderr, "mfs panic: ");
+  va_start(args, fmt);
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+  fprintf(stderr, "\n");
+  abort();
+}
+
+void util_stacktrace(void)
+{
+}
+
+/* The VFS side of these is not there on the host. */
+int ds_retrieve_label_endpt(const char *ds_name, endpoint_t *endpoint)
+{
+  return(ESRCH);
+}
+
+int env_parse(const char *env, const char *fmt, int field, long *param,
+	long min, long max)
+{
+  return(EP_UNSET);
+}
@@ -0,0 +1,582 @@
+/* mfs-bench - metadata microbenchmarks for the MFS core on the host.
+ *
+ * Usage: mfs-bench [-n entries] [-s size] [-t files] [-H hot] [-c chunk]
+ *		[-f json|csv] [-T tracefile] image [test ...]
+ *
+ * Every test works in a directory of its own, filled with the given number
+ * of entries first, and times each operation separately.  It prints one
+ * record per test (and per pass, for the deletion modes that take two):
+ * the operation rate, the latency percentiles and the block traffic to the
+ * image.  The image must be a scratch MFS file system; see bench.sh.
+ * With -T, the inode cache trace of an MFS built with INODE_TRACE is
+ * drained into the given file, for mfs-trace.
+ *
+ * Tests:
+ *   unlink	unlink in a directory without a mode file
+ *   unlink-A	unlink in mode A: every call is refused with EPERM
+ *   unlink-B	unlink in mode B: pass 1 marks (EINPROGRESS), pass 2 removes
+ *   unlink-C	unlink in mode C: pass 1 makes the .bak, pass 2 removes it
+ *   rename	rename every entry within its directory
+ *   link	add a second link to every entry
+ *   truncate	truncate files of the given size to zero
+ *   stat	stat every entry
+ *   statvfs	statvfs, as many times as there are entries
+ *   scan	stat a hot set of files again and again while a scan stats
+ *		every entry once, chunk entries between two hot rounds; the
+ *		record is for the hot calls, whose inode cache hit rate shows
+ *		how well the cache resists the scan
+ *   create-miss
+ *		create a file in one directory, then unlink a name missing
+ *		from another; the name hit rate shows whether the creates
+ *		keep the other directory's missing names cached
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <minix/mfsif.h>
+
+#include "mfs_host.h"
+
+#define NAME_FMT	"%s/f%07u"
+#define PATH_LEN	64
+#define WRITE_CHUNK	(64 * 1024)
+#define MISS_NAMES	64	/* missing names create-miss cycles through */
+#define DRAIN_EVERY	1024	/* calls; keeps the trace ring from wrapping */
+#define TRACE_BUF	(sizeof(struct mfs_trace_hdr) + \
+			 MFS_TRACE_SIZE * sizeof(struct mfs_trace_ev))
+
+struct result {
+  const char *r_test;
+  int r_pass;			/* 1 or 2; 0 if the test has one pass */
+  unsigned r_ops;
+  unsigned r_errors;		/* calls that did not return the expected */
+  double r_seconds;		/* total of the timed calls */
+  uint64_t r_reads, r_writes;	/* blocks to and from the image */
+  uint64_t r_ihits, r_imisses;	/* inode cache hits and misses */
+  uint64_t r_nhits, r_nmisses;	/* name cache hits and misses */
+  uint64_t *r_lat;		/* latency of each call, in ns */
+};
+
+typedef int (*op_t)(unsigned i, const char *dir);
+
+static unsigned entries = 1000;
+static off_t file_size = 1024 * 1024;
+static unsigned trunc_files = 64;
+static unsigned hot_files = 64;
+static unsigned scan_chunk = 1024;
+static int csv = 0;
+
+static uint64_t *lat;		/* latency buffer, one per entry */
+static char *wbuf;		/* data for the truncate test */
+static FILE *trace_fp;		/* -T file, or NULL */
+
+static uint64_t now_ns(void);
+static void name(char *buf, const char *dir, const char *fmt, unsigned i);
+static void fill(const char *dir, unsigned n, off_t size);
+static void empty(const char *dir, unsigned n, const char *fmt);
+static void done(const char *dir);
+static void drain(void);
+static void run_op(struct result *res, const char *dir, unsigned n, op_t op,
+	int expect);
+static void report(struct result *res);
+static void usage(void);
+
+/*===========================================================================*
+ *				helpers					     *
+ *===========================================================================*/
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+static void name(char *buf, const char *dir, const char *fmt, unsigned i)
+{
+  snprintf(buf, PATH_LEN, fmt, dir, i);
+}
+
+static void fill(const char *dir, unsigned n, off_t size)
+{
+/* Make the directory and n files of the given size in it. */
+  char path[PATH_LEN];
+  unsigned i;
+  off_t pos;
+  int r;
+
+  if ((r = mfs_host_mkdir(dir, 0755)) != 0) {
+	fprintf(stderr, "mfs-bench: mkdir %s: %s\n", dir, strerror(r));
+	exit(1);
+  }
+  for (i = 0; i < n; i++) {
+	name(path, dir, NAME_FMT, i);
+	if ((r = mfs_host_create(path, 0644)) != 0) {
+		fprintf(stderr, "mfs-bench: create %s: %s\n", path,
+			strerror(r));
+		exit(1);
+	}
+	for (pos = 0; pos < size; pos += WRITE_CHUNK) {
+		size_t len = size - pos < WRITE_CHUNK ? size - pos :
+			WRITE_CHUNK;
+		if ((r = mfs_host_write(path, pos, wbuf, len)) != 0) {
+			fprintf(stderr, "mfs-bench: write %s: %s\n", path,
+				strerror(r));
+			exit(1);
+		}
+	}
+  }
+  mfs_host_sync();
+}
+
+static void empty(const char *dir, unsigned n, const char *fmt)
+{
+/* Remove the entries a test left behind. */
+  char path[PATH_LEN];
+  unsigned i;
+
+  for (i = 0; i < n; i++) {
+	name(path, dir, fmt, i);
+	(void) mfs_host_unlink(path);
+  }
+}
+
+static void done(const char *dir)
+{
+  if (mfs_host_rmdir(dir) != 0)
+	fprintf(stderr, "mfs-bench: %s not empty after the test\n", dir);
+  mfs_host_sync();
+}
+
+static void drain(void)
+{
+/* Append the events since the last drain to the trace file. */
+  static char *buf;
+  size_t used;
+
+  if (trace_fp == NULL) return;
+  if (buf == NULL && (buf = malloc(TRACE_BUF)) == NULL) return;
+  if (mfs_host_trace(buf, TRACE_BUF, &used) == 0 &&
+      used > sizeof(struct mfs_trace_hdr))
+	fwrite(buf, 1, used, trace_fp);
+}
+
+/*===========================================================================*
+ *				run_op					     *
+ *===========================================================================*/
+static void run_op(
+  struct result *res,		/* filled in */
+  const char *dir,		/* the test directory */
+  unsigned n,			/* number of calls */
+  op_t op,			/* the call, for entry i */
+  int expect			/* what each call should return */
+)
+{
+  uint64_t start, end, reads, writes, ihits, imisses, nhits, nmisses;
+  unsigned i;
+
+  reads = host_blocks_read;
+  writes = host_blocks_written;
+  mfs_host_icache(&ihits, &imisses);
+  mfs_host_names(&nhits, &nmisses);
+  res->r_ops = n;
+  res->r_errors = 0;
+  res->r_seconds = 0;
+  res->r_lat = lat;
+
+  for (i = 0; i < n; i++) {
+	start = now_ns();
+	if (op(i, dir) != expect) res->r_errors++;
+	end = now_ns();
+	lat[i] = end - start;
+	res->r_seconds += (end - start) / 1e9;
+	if (i % DRAIN_EVERY == DRAIN_EVERY - 1) drain();
+  }
+  drain();
+
+  /* Count the write-back of what the calls dirtied as theirs. */
+  mfs_host_sync();
+  res->r_reads = host_blocks_read - reads;
+  res->r_writes = host_blocks_written - writes;
+  mfs_host_icache(&res->r_ihits, &res->r_imisses);
+  res->r_ihits -= ihits;
+  res->r_imisses -= imisses;
+  mfs_host_names(&res->r_nhits, &res->r_nmisses);
+  res->r_nhits -= nhits;
+  res->r_nmisses -= nmisses;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+  return(x < y ? -1 : x > y);
+}
+
+/*===========================================================================*
+ *				report					     *
+ *===========================================================================*/
+static void report(struct result *res)
+{
+  static int header = 0;
+  double pct[] = { 50, 90, 99, 99.9 };
+  uint64_t p[4], max;
+  unsigned k;
+
+  if (res->r_ops == 0) return;
+  qsort(res->r_lat, res->r_ops, sizeof(uint64_t), cmp_u64);
+  for (k = 0; k < 4; k++)
+	p[k] = res->r_lat[(unsigned) (pct[k] / 100 * (res->r_ops - 1))];
+  max = res->r_lat[res->r_ops - 1];
+
+  if (csv) {
+	if (!header++)
+		printf("test,pass,entries,ops,errors,ops_per_sec,p50_ns,"
+		    "p90_ns,p99_ns,p999_ns,max_ns,blocks_read,"
+		    "blocks_written,inode_hits,inode_misses,name_hits,"
+		    "name_misses\n");
+	printf("%s,%d,%u,%u,%u,%.0f,%llu,%llu,%llu,%llu,%llu,%llu,%llu,"
+	    "%llu,%llu,%llu,%llu\n",
+	    res->r_test, res->r_pass, entries, res->r_ops, res->r_errors,
+	    res->r_ops / res->r_seconds,
+	    (unsigned long long) p[0], (unsigned long long) p[1],
+	    (unsigned long long) p[2], (unsigned long long) p[3],
+	    (unsigned long long) max, (unsigned long long) res->r_reads,
+	    (unsigned long long) res->r_writes,
+	    (unsigned long long) res->r_ihits,
+	    (unsigned long long) res->r_imisses,
+	    (unsigned long long) res->r_nhits,
+	    (unsigned long long) res->r_nmisses);
+  } else {
+	printf("{\"test\":\"%s\",\"pass\":%d,\"entries\":%u,\"ops\":%u,"
+	    "\"errors\":%u,\"ops_per_sec\":%.0f,\"p50_ns\":%llu,"
+	    "\"p90_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,"
+	    "\"max_ns\":%llu,\"blocks_read\":%llu,\"blocks_written\":%llu,"
+	    "\"inode_hits\":%llu,\"inode_misses\":%llu,"
+	    "\"name_hits\":%llu,\"name_misses\":%llu}\n",
+	    res->r_test, res->r_pass, entries, res->r_ops, res->r_errors,
+	    res->r_ops / res->r_seconds,
+	    (unsigned long long) p[0], (unsigned long long) p[1],
+	    (unsigned long long) p[2], (unsigned long long) p[3],
+	    (unsigned long long) max, (unsigned long long) res->r_reads,
+	    (unsigned long long) res->r_writes,
+	    (unsigned long long) res->r_ihits,
+	    (unsigned long long) res->r_imisses,
+	    (unsigned long long) res->r_nhits,
+	    (unsigned long long) res->r_nmisses);
+  }
+  fflush(stdout);
+}
+
+/*===========================================================================*
+ *				operations				     *
+ *===========================================================================*/
+static int op_unlink(unsigned i, const char *dir)
+{
+  char path[PATH_LEN];
+
+  name(path, dir, NAME_FMT, i);
+  return(mfs_host_unlink(path));
+}
+
+static int op_unlink_bak(unsigned i, const char *dir)
+{
+  char path[PATH_LEN];
+
+  name(path, dir, NAME_FMT ".bak", i);
+  return(mfs_host_unlink(path));
+}
+
+static int op_rename(unsigned i, const char *dir)
+{
+  char from[PATH_LEN], to[PATH_LEN];
+
+  name(from, dir, NAME_FMT, i);
+  name(to, dir, "%s/g%07u", i);
+  return(mfs_host_rename(from, to, 0));
+}
+
+static int op_link(unsigned i, const char *dir)
+{
+  char from[PATH_LEN], to[PATH_LEN];
+
+  name(from, dir, NAME_FMT, i);
+  name(to, dir, "%s/l%07u", i);
+  return(mfs_host_link(from, to));
+}
+
+static int op_truncate(unsigned i, const char *dir)
+{
+  char path[PATH_LEN];
+
+  name(path, dir, NAME_FMT, i);
+  return(mfs_host_truncate(path, 0));
+}
+
+static int op_stat(unsigned i, const char *dir)
+{
+  char path[PATH_LEN];
+  struct stat st;
+
+  name(path, dir, NAME_FMT, i);
+  return(mfs_host_stat(path, &st));
+}
+
+static int op_create_miss(unsigned i, const char *dir)
+{
+  char sub[PATH_LEN], path[PATH_LEN];
+  int r;
+
+  snprintf(sub, sizeof(sub), "%s/new", dir);
+  name(path, sub, NAME_FMT, i);
+  if ((r = mfs_host_create(path, 0644)) != 0) return(r);
+  name(path, dir, "%s/m%07u", i % MISS_NAMES);
+  return(mfs_host_unlink(path));
+}
+
+static int op_statvfs(unsigned i, const char *dir)
+{
+  struct statvfs st;
+
+  (void) i;
+  (void) dir;
+  return(mfs_host_statvfs(&st));
+}
+
+/*===========================================================================*
+ *				tests					     *
+ *===========================================================================*/
+static void test_unlink_mode(const char *test, char mode)
+{
+  char dir[PATH_LEN], modefile[PATH_LEN];
+  struct result res;
+
+  snprintf(dir, sizeof(dir), "/%s", test);
+  fill(dir, entries, 0);
+  if (mode != '\0') {
+	snprintf(modefile, sizeof(modefile), "%s/%c.mode", dir, mode);
+	if (mfs_host_create(modefile, 0644) != 0) exit(1);
+  }
+
+  res.r_test = test;
+  switch (mode) {
+  case '\0':
+	res.r_pass = 0;
+	run_op(&res, dir, entries, op_unlink, 0);
+	report(&res);
+	break;
+  case 'A':
+	res.r_pass = 0;
+	run_op(&res, dir, entries, op_unlink, EPERM);
+	report(&res);
+	break;
+  case 'B':
+	res.r_pass = 1;
+	run_op(&res, dir, entries, op_unlink, EINPROGRESS);
+	report(&res);
+	res.r_pass = 2;
+	run_op(&res, dir, entries, op_unlink, 0);
+	report(&res);
+	break;
+  case 'C':
+	res.r_pass = 1;
+	run_op(&res, dir, entries, op_unlink, 0);
+	report(&res);
+	res.r_pass = 2;
+	run_op(&res, dir, entries, op_unlink_bak, 0);
+	report(&res);
+	break;
+  }
+
+  if (mode != '\0') (void) mfs_host_unlink(modefile);
+  empty(dir, entries, NAME_FMT);
+  done(dir);
+}
+
+static void test_simple(const char *test, op_t op, const char *left)
+{
+  char dir[PATH_LEN];
+  struct result res;
+
+  snprintf(dir, sizeof(dir), "/%s", test);
+  fill(dir, entries, 0);
+
+  res.r_test = test;
+  res.r_pass = 0;
+  run_op(&res, dir, entries, op, 0);
+  report(&res);
+
+  if (left != NULL) empty(dir, entries, left);
+  empty(dir, entries, NAME_FMT);
+  done(dir);
+}
+
+static void test_truncate(void)
+{
+  struct result res;
+
+  fill("/truncate", trunc_files, file_size);
+
+  res.r_test = "truncate";
+  res.r_pass = 0;
+  run_op(&res, "/truncate", trunc_files, op_truncate, 0);
+  report(&res);
+
+  empty("/truncate", trunc_files, NAME_FMT);
+  done("/truncate");
+}
+
+static void test_create_miss(void)
+{
+  struct result res;
+
+  fill("/create-miss", entries, 0);
+  fill("/create-miss/new", 0, 0);
+
+  res.r_test = "create-miss";
+  res.r_pass = 0;
+  run_op(&res, "/create-miss", entries, op_create_miss, ENOENT);
+  report(&res);
+
+  empty("/create-miss/new", entries, NAME_FMT);
+  done("/create-miss/new");
+  empty("/create-miss", entries, NAME_FMT);
+  done("/create-miss");
+}
+
+static void test_scan(void)
+{
+  struct result res;
+  uint64_t start, end, h0, m0, h1, m1, reads, writes;
+  unsigned i, cold;
+
+  fill("/scan.hot", hot_files, 0);
+  fill("/scan.cold", entries, 0);
+  for (i = 0; i < hot_files; i++) (void) op_stat(i, "/scan.hot");
+
+  res.r_test = "scan";
+  res.r_pass = 0;
+  res.r_ops = res.r_errors = 0;
+  res.r_seconds = 0;
+  res.r_ihits = res.r_imisses = 0;
+  res.r_nhits = res.r_nmisses = 0;
+  res.r_lat = lat;
+  reads = host_blocks_read;
+  writes = host_blocks_written;
+
+  for (cold = 0; cold < entries; ) {
+	for (i = 0; i < scan_chunk && cold < entries; i++, cold++)
+		(void) op_stat(cold, "/scan.cold");
+
+	/* Only the hot calls are timed and counted. */
+	for (i = 0; i < hot_files; i++) {
+		mfs_host_icache(&h0, &m0);
+		start = now_ns();
+		if (op_stat(i, "/scan.hot") != 0) res.r_errors++;
+		end = now_ns();
+		mfs_host_icache(&h1, &m1);
+		lat[res.r_ops++] = end - start;
+		res.r_seconds += (end - start) / 1e9;
+		res.r_ihits += h1 - h0;
+		res.r_imisses += m1 - m0;
+	}
+	drain();
+  }
+  res.r_reads = host_blocks_read - reads;
+  res.r_writes = host_blocks_written - writes;
+  report(&res);
+
+  empty("/scan.hot", hot_files, NAME_FMT);
+  done("/scan.hot");
+  empty("/scan.cold", entries, NAME_FMT);
+  done("/scan.cold");
+}
+
+static void usage(void)
+{
+  fprintf(stderr, "Usage: mfs-bench [-n entries] [-s size] [-t files] "
+	"[-H hot] [-c chunk]\n\t\t[-f json|csv] [-T tracefile] image "
+	"[test ...]\n");
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  static const char *all[] = { "unlink", "unlink-A", "unlink-B", "unlink-C",
+	"rename", "link", "truncate", "stat", "statvfs", "scan", "create-miss",
+	NULL };
+  const char **tests;
+  size_t nr_lat;
+  int c, r;
+
+  while ((c = getopt(argc, argv, "n:s:t:f:T:H:c:")) != -1) {
+	switch (c) {
+	case 'n': entries = strtoul(optarg, NULL, 0); break;
+	case 's': file_size = strtoll(optarg, NULL, 0); break;
+	case 't': trunc_files = strtoul(optarg, NULL, 0); break;
+	case 'H': hot_files = strtoul(optarg, NULL, 0); break;
+	case 'c': scan_chunk = strtoul(optarg, NULL, 0); break;
+	case 'f': csv = (strcmp(optarg, "csv") == 0); break;
+	case 'T':
+		if ((trace_fp = fopen(optarg, "w")) == NULL) {
+			fprintf(stderr, "mfs-bench: %s: %s\n", optarg,
+				strerror(errno));
+			return(1);
+		}
+		break;
+	default: usage();
+	}
+  }
+  argc -= optind;
+  argv += optind;
+  if (argc < 1 || entries == 0 || scan_chunk == 0) usage();
+
+  tests = argc > 1 ? (const char **) argv + 1 : all;
+  /* The scan test times hot_files calls per chunk of the entries. */
+  nr_lat = entries > trunc_files ? entries : trunc_files;
+  if (nr_lat < (size_t) hot_files * (entries / scan_chunk + 1))
+	nr_lat = (size_t) hot_files * (entries / scan_chunk + 1);
+  if ((lat = calloc(nr_lat, sizeof(*lat))) == NULL ||
+      (wbuf = calloc(1, WRITE_CHUNK)) == NULL) {
+	fprintf(stderr, "mfs-bench: out of memory\n");
+	return(1);
+  }
+
+  if ((r = mfs_host_mount(argv[0], 0)) != 0) {
+	fprintf(stderr, "mfs-bench: mounting %s: %s\n", argv[0],
+		strerror(r));
+	return(1);
+  }
+
+  for (; *tests != NULL; tests++) {
+	if (strcmp(*tests, "unlink") == 0) test_unlink_mode(*tests, '\0');
+	else if (strcmp(*tests, "unlink-A") == 0) test_unlink_mode(*tests, 'A');
+	else if (strcmp(*tests, "unlink-B") == 0) test_unlink_mode(*tests, 'B');
+	else if (strcmp(*tests, "unlink-C") == 0) test_unlink_mode(*tests, 'C');
+	else if (strcmp(*tests, "rename") == 0)
+		test_simple(*tests, op_rename, "%s/g%07u");
+	else if (strcmp(*tests, "link") == 0)
+		test_simple(*tests, op_link, "%s/l%07u");
+	else if (strcmp(*tests, "stat") == 0)
+		test_simple(*tests, op_stat, NULL);
+	else if (strcmp(*tests, "statvfs") == 0)
+		test_simple(*tests, op_statvfs, NULL);
+	else if (strcmp(*tests, "truncate") == 0) test_truncate();
+	else if (strcmp(*tests, "scan") == 0) test_scan();
+	else if (strcmp(*tests, "create-miss") == 0) test_create_miss();
+	else fprintf(stderr, "mfs-bench: unknown test %s\n", *tests);
+  }
+
+  if ((r = mfs_host_unmount()) != 0) {
+	fprintf(stderr, "mfs-bench: unmounting: %s\n", strerror(r));
+	return(1);
+  }
+  if (trace_fp != NULL) fclose(trace_fp);
+  return(0);
+}
@@ -0,0 +1,195 @@
+/* mfs-host - run MFS requests against an image file on the host.
+ *
+ * Usage: mfs-host [-r] image command [arg ...]
+ *        mfs-host [-r] image -		(one command per line on stdin)
+ *
+ * Commands:
+ *   stat path			statvfs
+ *   create path		mkdir path
+ *   write path text		truncate path size
+ *   unlink path		rmdir path
+ *   rename from to [noreplace|exchange]
+ *   link from to		compact dir
+ *   rmtree path		copytree from to
+ *   clone from to		fill path size
+ *   modegen			(print the cached mode generation)
+ *   crash			(stop without writing anything back)
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <minix/mfsif.h>
+
+#include "mfs_host.h"
+
+#define MAX_ARGS	8
+
+static int crashed;
+
+static int run(int argc, char **argv);
+static int fill(const char *path, off_t size);
+static void usage(void);
+
+int main(int argc, char **argv)
+{
+  char line[1024], *args[MAX_ARGS], *cp;
+  int rdonly = 0, n, r, status = 0;
+
+  if (argc > 1 && strcmp(argv[1], "-r") == 0) {
+	rdonly = 1;
+	argc--;
+	argv++;
+  }
+  if (argc < 3) usage();
+
+  if ((r = mfs_host_mount(argv[1], rdonly)) != 0) {
+	fprintf(stderr, "mfs-host: mounting %s: %s\n", argv[1], strerror(r));
+	return(1);
+  }
+
+  if (strcmp(argv[2], "-") != 0) {
+	status = run(argc - 2, argv + 2);
+  } else {
+	while (!crashed && fgets(line, sizeof(line), stdin) != NULL) {
+		n = 0;
+		for (cp = strtok(line, " \t\n"); cp != NULL && n < MAX_ARGS;
+		    cp = strtok(NULL, " \t\n"))
+			args[n++] = cp;
+		if (n == 0 || args[0][0] == '#') continue;
+		if (run(n, args) != 0) status = 1;
+	}
+  }
+
+  if (crashed) return(status);
+  if ((r = mfs_host_unmount()) != 0) {
+	fprintf(stderr, "mfs-host: unmounting: %s\n", strerror(r));
+	status = 1;
+  }
+  return(status);
+}
+
+static int run(int argc, char **argv)
+{
+  struct stat st;
+  struct statvfs svfs;
+  struct mfs_rmtree rt;
+  struct mfs_copytree ct;
+  const char *cmd = argv[0];
+  int r, flags;
+
+#define ARGS(n)	if (argc != (n) + 1) { r = EINVAL; goto out; }
+
+  if (strcmp(cmd, "stat") == 0) {
+	ARGS(1);
+	if ((r = mfs_host_stat(argv[1], &st)) == 0)
+		printf("%s: ino %llu mode %o nlink %u uid %u gid %u size %lld "
+		    "mtime %lld.%09ld\n", argv[1],
+		    (unsigned long long) st.st_ino, (unsigned) st.st_mode,
+		    (unsigned) st.st_nlink, (unsigned) st.st_uid,
+		    (unsigned) st.st_gid, (long long) st.st_size,
+		    (long long) st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+  } else if (strcmp(cmd, "statvfs") == 0) {
+	ARGS(0);
+	if ((r = mfs_host_statvfs(&svfs)) == 0)
+		printf("bsize %lu blocks %llu bfree %llu files %llu "
+		    "ffree %llu\n", (unsigned long) svfs.f_bsize,
+		    (unsigned long long) svfs.f_blocks,
+		    (unsigned long long) svfs.f_bfree,
+		    (unsigned long long) svfs.f_files,
+		    (unsigned long long) svfs.f_ffree);
+  } else if (strcmp(cmd, "create") == 0) {
+	ARGS(1);
+	r = mfs_host_create(argv[1], 0644);
+  } else if (strcmp(cmd, "mkdir") == 0) {
+	ARGS(1);
+	r = mfs_host_mkdir(argv[1], 0755);
+  } else if (strcmp(cmd, "write") == 0) {
+	ARGS(2);
+	r = mfs_host_write(argv[1], 0, argv[2], strlen(argv[2]));
+  } else if (strcmp(cmd, "truncate") == 0) {
+	ARGS(2);
+	r = mfs_host_truncate(argv[1], (off_t) strtoll(argv[2], NULL, 0));
+  } else if (strcmp(cmd, "unlink") == 0) {
+	ARGS(1);
+	r = mfs_host_unlink(argv[1]);
+  } else if (strcmp(cmd, "rmdir") == 0) {
+	ARGS(1);
+	r = mfs_host_rmdir(argv[1]);
+  } else if (strcmp(cmd, "rename") == 0) {
+	if (argc != 3 && argc != 4) { r = EINVAL; goto out; }
+	flags = 0;
+	if (argc == 4 && strcmp(argv[3], "noreplace") == 0)
+		flags = RENAME_NOREPLACE;
+	else if (argc == 4 && strcmp(argv[3], "exchange") == 0)
+		flags = RENAME_EXCHANGE;
+	else if (argc == 4) { r = EINVAL; goto out; }
+	r = mfs_host_rename(argv[1], argv[2], flags);
+  } else if (strcmp(cmd, "link") == 0) {
+	ARGS(2);
+	r = mfs_host_link(argv[1], argv[2]);
+  } else if (strcmp(cmd, "compact") == 0) {
+	ARGS(1);
+	r = mfs_host_compact(argv[1]);
+  } else if (strcmp(cmd, "rmtree") == 0) {
+	ARGS(1);
+	if ((r = mfs_host_rmtree(argv[1], &rt)) == 0)
+		printf("removed %u kept %u failed %u\n", rt.rt_removed,
+		    rt.rt_kept, rt.rt_failed);
+	if (r == 0 && rt.rt_failed > 0) r = rt.rt_error;
+  } else if (strcmp(cmd, "copytree") == 0) {
+	ARGS(2);
+	if ((r = mfs_host_copytree(argv[1], argv[2], &ct)) == 0)
+		printf("copied %u failed %u blocks %llu\n", ct.ct_copied,
+		    ct.ct_failed, (unsigned long long) ct.ct_blocks);
+	if (r == 0 && ct.ct_failed > 0) r = ct.ct_error;
+  } else if (strcmp(cmd, "clone") == 0) {
+	ARGS(2);
+	r = mfs_host_clone(argv[1], argv[2]);
+  } else if (strcmp(cmd, "modegen") == 0) {
+	ARGS(0);
+	printf("mode_gen %u\n", mfs_host_mode_gen());
+	r = 0;
+  } else if (strcmp(cmd, "fill") == 0) {
+	ARGS(2);
+	r = fill(argv[1], (off_t) strtoll(argv[2], NULL, 0));
+  } else if (strcmp(cmd, "crash") == 0) {
+	ARGS(0);
+	mfs_host_crash();
+	crashed = 1;
+	r = 0;
+  } else {
+	r = EINVAL;
+  }
+
+out:
+  if (r != 0) fprintf(stderr, "mfs-host: %s: %s\n", cmd, strerror(r));
+  return(r != 0);
+}
+
+static int fill(const char *path, off_t size)
+{
+/* Write zeros over the first 'size' bytes of 'path', so that all of its
+ * blocks are there, as the journal needs.
+ */
+  static char zeros[4096];
+  off_t pos;
+  size_t len;
+  int r;
+
+  for (pos = 0; pos < size; pos += len) {
+	len = sizeof(zeros);
+	if (size - pos < (off_t) len) len = (size_t) (size - pos);
+	if ((r = mfs_host_write(path, pos, zeros, len)) != 0) return(r);
+  }
+  return(0);
+}
+
+static void usage(void)
+{
+  fprintf(stderr, "Usage: mfs-host [-r] image command [arg ...]\n"
+	"       mfs-host [-r] image -\n");
+  exit(1);
+}
@@ -0,0 +1,307 @@
+/* mfs-trace - analyse an inode cache trace drained with REQ_MFS_TRACE.
+ *
+ * Usage: mfs-trace [-f json|csv] [-w windows] heat file
+ *        mfs-trace [-f json|csv] reuse file
+ *
+ * The file is what the drains returned, one after the other: each a
+ * struct mfs_trace_hdr followed by its events (mfs-bench -T writes one).
+ *
+ * heat	 one record per inode, hottest first: the number of each kind of
+ *	 event, and the get_inode calls in each of the given number of equal
+ *	 time windows, which laid side by side make a heat map
+ * reuse a reuse distance histogram of the get_inode calls (the number of
+ *	 other inodes asked for since the last call for the same one), and from
+ *	 it the hit rate an LRU inode cache of each size would have had
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <minix/mfsif.h>
+
+#define NR_TYPES	(MFS_TR_WRITE + 1)
+#define MAX_BUCKETS	32	/* reuse distances up to 2^31 */
+
+struct ino_stat {
+  uint64_t is_ino;
+  uint32_t is_dev;
+  uint64_t is_count[NR_TYPES];
+  uint64_t is_calls;		/* get_inode calls: hits plus misses */
+  uint64_t is_last;		/* index of its last get_inode call + 1 */
+  uint64_t *is_window;		/* get_inode calls per window */
+};
+
+static const char *type_name[NR_TYPES] = {
+  NULL, "hit", "miss", "evict", "writeback", "trunc", "read", "write"
+};
+
+static struct mfs_trace_ev *evs;
+static size_t nr_evs;
+static uint64_t lost;
+
+static struct ino_stat *inos;	/* open hash on (dev, ino) */
+static size_t inos_size, nr_inos;
+
+static int csv = 0;
+static unsigned windows = 20;
+
+static void load(const char *file);
+static struct ino_stat *lookup(uint32_t dev, uint64_t ino);
+static void heat(void);
+static void reuse(void);
+static void usage(void);
+
+static int is_call(const struct mfs_trace_ev *ev)
+{
+  return(ev->te_type == MFS_TR_HIT || ev->te_type == MFS_TR_MISS);
+}
+
+/*===========================================================================*
+ *				load					     *
+ *===========================================================================*/
+static void load(const char *file)
+{
+  struct mfs_trace_hdr hdr;
+  size_t cap = 0;
+  FILE *fp;
+
+  if ((fp = fopen(file, "r")) == NULL) {
+	fprintf(stderr, "mfs-trace: %s: %s\n", file, strerror(errno));
+	exit(1);
+  }
+
+  while (fread(&hdr, sizeof(hdr), 1, fp) == 1) {
+	lost += hdr.th_lost;
+	if (nr_evs + hdr.th_count > cap) {
+		cap = (nr_evs + hdr.th_count) * 2;
+		if ((evs = realloc(evs, cap * sizeof(*evs))) == NULL) {
+			fprintf(stderr, "mfs-trace: out of memory\n");
+			exit(1);
+		}
+	}
+	if (fread(&evs[nr_evs], sizeof(*evs), hdr.th_count, fp) !=
+	    hdr.th_count) {
+		fprintf(stderr, "mfs-trace: %s: truncated\n", file);
+		exit(1);
+	}
+	nr_evs += hdr.th_count;
+  }
+  fclose(fp);
+
+  if (lost > 0)
+	fprintf(stderr, "mfs-trace: %llu events were lost before draining\n",
+		(unsigned long long) lost);
+}
+
+/*===========================================================================*
+ *				lookup					     *
+ *===========================================================================*/
+static struct ino_stat *lookup(uint32_t dev, uint64_t ino)
+{
+  struct ino_stat *old, *is;
+  size_t i, old_size;
+
+  if (2 * (nr_inos + 1) > inos_size) {
+	old = inos;
+	old_size = inos_size;
+	inos_size = inos_size ? inos_size * 2 : 1024;
+	if ((inos = calloc(inos_size, sizeof(*inos))) == NULL) {
+		fprintf(stderr, "mfs-trace: out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < old_size; i++) {
+		if (old[i].is_ino == 0) continue;
+		is = &inos[old[i].is_ino * 2654435761u % inos_size];
+		while (is->is_ino != 0)
+			if (++is == &inos[inos_size]) is = inos;
+		*is = old[i];
+	}
+	free(old);
+  }
+
+  is = &inos[ino * 2654435761u % inos_size];
+  while (is->is_ino != 0) {
+	if (is->is_ino == ino && is->is_dev == dev) return(is);
+	if (++is == &inos[inos_size]) is = inos;
+  }
+  is->is_ino = ino;
+  is->is_dev = dev;
+  if ((is->is_window = calloc(windows, sizeof(uint64_t))) == NULL) {
+	fprintf(stderr, "mfs-trace: out of memory\n");
+	exit(1);
+  }
+  nr_inos++;
+  return(is);
+}
+
+static int cmp_calls(const void *a, const void *b)
+{
+  const struct ino_stat *x = a, *y = b;
+
+  if (x->is_calls != y->is_calls) return(x->is_calls < y->is_calls ? 1 : -1);
+  return(x->is_ino < y->is_ino ? -1 : x->is_ino > y->is_ino);
+}
+
+/*===========================================================================*
+ *				heat					     *
+ *===========================================================================*/
+static void heat(void)
+{
+  struct ino_stat *is, *sorted;
+  uint64_t t0, span;
+  size_t i, n;
+  unsigned w;
+  int t;
+
+  if (nr_evs == 0) return;
+  t0 = evs[0].te_time;
+  span = evs[nr_evs - 1].te_time - t0 + 1;
+
+  for (i = 0; i < nr_evs; i++) {
+	if (evs[i].te_type >= NR_TYPES) continue;
+	is = lookup(evs[i].te_dev, evs[i].te_ino);
+	is->is_count[evs[i].te_type]++;
+	if (is_call(&evs[i])) {
+		is->is_calls++;
+		w = (unsigned) ((double) (evs[i].te_time - t0) / span * windows);
+		is->is_window[w]++;
+	}
+  }
+
+  /* Pack the hash table and sort it, hottest first. */
+  if ((sorted = malloc(nr_inos * sizeof(*sorted))) == NULL) exit(1);
+  for (i = n = 0; i < inos_size; i++)
+	if (inos[i].is_ino != 0) sorted[n++] = inos[i];
+  qsort(sorted, n, sizeof(*sorted), cmp_calls);
+
+  if (csv) {
+	printf("dev,ino,calls");
+	for (t = 1; t < NR_TYPES; t++) printf(",%s", type_name[t]);
+	for (w = 0; w < windows; w++) printf(",w%u", w);
+	printf("\n");
+  }
+  for (i = 0; i < n; i++) {
+	is = &sorted[i];
+	if (csv) {
+		printf("%u,%llu,%llu", is->is_dev,
+		    (unsigned long long) is->is_ino,
+		    (unsigned long long) is->is_calls);
+		for (t = 1; t < NR_TYPES; t++)
+			printf(",%llu", (unsigned long long) is->is_count[t]);
+		for (w = 0; w < windows; w++)
+			printf(",%llu", (unsigned long long) is->is_window[w]);
+	} else {
+		printf("{\"dev\":%u,\"ino\":%llu,\"calls\":%llu", is->is_dev,
+		    (unsigned long long) is->is_ino,
+		    (unsigned long long) is->is_calls);
+		for (t = 1; t < NR_TYPES; t++)
+			printf(",\"%s\":%llu", type_name[t],
+			    (unsigned long long) is->is_count[t]);
+		printf(",\"windows\":[");
+		for (w = 0; w < windows; w++)
+			printf("%s%llu", w ? "," : "",
+			    (unsigned long long) is->is_window[w]);
+		printf("]}");
+	}
+	printf("\n");
+  }
+  free(sorted);
+}
+
+/*===========================================================================*
+ *				reuse					     *
+ *===========================================================================*/
+static void reuse(void)
+{
+/* The distance of a call is the number of distinct inodes asked for since
+ * the last call for the same inode.  A Fenwick tree over the call indices
+ * marks the latest call of every inode, so it is a range sum.
+ */
+  struct ino_stat *is;
+  uint64_t *tree, hist[MAX_BUCKETS], cold = 0, calls = 0, hits = 0;
+  uint64_t d, cum, now, j;
+  size_t i;
+  int b;
+
+  if ((tree = calloc(nr_evs + 1, sizeof(*tree))) == NULL) exit(1);
+  memset(hist, 0, sizeof(hist));
+
+#define ADD(pos, v)	for (j = (pos); j <= nr_evs; j += j & -j) tree[j] += (v)
+#define SUM(pos, s)	for (s = 0, j = (pos); j > 0; j -= j & -j) s += tree[j]
+
+  for (i = 0; i < nr_evs; i++) {
+	if (!is_call(&evs[i])) continue;
+	now = ++calls;
+	if (evs[i].te_type == MFS_TR_HIT) hits++;
+	is = lookup(evs[i].te_dev, evs[i].te_ino);
+
+	if (is->is_last == 0) {
+		cold++;
+	} else {
+		uint64_t upto_now, upto_last;
+		SUM(now - 1, upto_now);
+		SUM(is->is_last, upto_last);
+		d = upto_now - upto_last;
+		for (b = 0; d > 0 && b < MAX_BUCKETS - 1; b++) d >>= 1;
+		hist[b]++;
+		ADD(is->is_last, -1);
+	}
+	ADD(now, 1);
+	is->is_last = now;
+  }
+
+  /* Bucket b holds distances in [2^(b-1), 2^b), bucket 0 distance 0.  An
+   * LRU cache of 2^b inodes hits on every distance below 2^b.
+   */
+  if (csv) printf("cache_size,distance_calls,lru_hit_rate\n");
+  for (b = 0, cum = 0; b < MAX_BUCKETS; b++) {
+	cum += hist[b];
+	if (csv)
+		printf("%llu,%llu,%.4f\n", 1ULL << b,
+		    (unsigned long long) hist[b],
+		    calls ? (double) cum / calls : 0);
+	else
+		printf("{\"cache_size\":%llu,\"distance_calls\":%llu,"
+		    "\"lru_hit_rate\":%.4f}\n", 1ULL << b,
+		    (unsigned long long) hist[b],
+		    calls ? (double) cum / calls : 0);
+	if (cum + cold == calls) break;
+  }
+  fprintf(stderr, "mfs-trace: %llu calls, %llu cold, observed hit rate "
+	"%.4f\n", (unsigned long long) calls, (unsigned long long) cold,
+	calls ? (double) hits / calls : 0);
+  free(tree);
+}
+
+static void usage(void)
+{
+  fprintf(stderr, "Usage: mfs-trace [-f json|csv] [-w windows] heat file\n"
+	"       mfs-trace [-f json|csv] reuse file\n");
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  int c;
+
+  while ((c = getopt(argc, argv, "f:w:")) != -1) {
+	switch (c) {
+	case 'f': csv = (strcmp(optarg, "csv") == 0); break;
+	case 'w': windows = strtoul(optarg, NULL, 0); break;
+	default: usage();
+	}
+  }
+  argc -= optind;
+  argv += optind;
+  if (argc != 2 || windows == 0) usage();
+
+  load(argv[1]);
+  if (strcmp(argv[0], "heat") == 0) heat();
+  else if (strcmp(argv[0], "reuse") == 0) reuse();
+  else usage();
+  return(0);
+}
@@ -0,0 +1,515 @@
+/* This file plays VFS for the MFS core on the host.  Every call resolves its
+ * path with advance(), fills in fs_m_in the way VFS would and calls the
+ * handler from fs_call_vec directly.
+ *
+ * The entry points into this file are
+ *   mfs_host_mount:   open an image and read its super block
+ *   mfs_host_crash:   let go of it without writing anything back
+ *   mfs_host_request: send one raw request
+ *   mfs_host_trace:   drain the inode cache trace
+ *   mfs_host_*:       the path based calls declared in mfs_host.h
+ */
+
+#include "fs.h"
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <minix/vfsif.h>
+#include "inode.h"
+#include "dcache.h"
+#include "reqstats.h"
+#include "journal.h"
+#include "mfs_host.h"
+
+static int image_fd = -1;
+static ino_t root_ino;
+
+static int resolve(const char *path, int parent, ino_t *inop, char *last);
+static int dir_request(int req, const char *path, mode_t mode);
+
+/*===========================================================================*
+ *				mfs_host_request			     *
+ *===========================================================================*/
+int mfs_host_request(
+  int req,			/* REQ_*, of <minix/vfsif.h> or <minix/mfsif.h> */
+  message *m			/* request in, reply out */
+)
+{
+/* Do what the main loop does with a request from VFS. */
+  int ind, r;
+
+  ind = req - FS_BASE;
+  if (ind < 0 || ind >= MFS_NREQS || fs_call_vec[ind] == NULL)
+	return(EINVAL);
+
+  fs_m_in = *m;
+  fs_m_in.m_type = req;
+  fs_m_in.m_source = VFS_PROC_NR;
+  memset(&fs_m_out, 0, sizeof(fs_m_out));
+
+  r = req_stats_call(ind, fs_call_vec[ind]);
+
+  host_ungrant();
+  *m = fs_m_out;
+  return(r);
+}
+
+/*===========================================================================*
+ *				mfs_host_trace				     *
+ *===========================================================================*/
+int mfs_host_trace(
+  void *buf,			/* gets a header and the events */
+  size_t len,			/* size of buf */
+  size_t *used			/* how much of it was filled */
+)
+{
+  message m;
+  int r;
+
+  memset(&m, 0, sizeof(m));
+  m.m_vfs_fs_getdents.grant = host_grant(buf, len);
+  m.m_vfs_fs_getdents.mem_size = len;
+  if ((r = mfs_host_request(REQ_MFS_TRACE, &m)) != OK) return(r);
+  *used = m.m_fs_vfs_getdents.nbytes;
+  return(OK);
+}
+
+void mfs_host_icache(uint64_t *hits, uint64_t *misses)
+{
+  *hits = inode_cache_hit;
+  *misses = inode_cache_miss;
+}
+
+void mfs_host_names(uint64_t *hits, uint64_t *misses)
+{
+  *hits = dc_stats.ns_hits + dc_stats.ns_neg_hits;
+  *misses = dc_stats.ns_misses;
+}
+
+unsigned int mfs_host_mode_gen(void)
+{
+  return(mode_gen);
+}
+
+/*===========================================================================*
+ *				mfs_host_mount				     *
+ *===========================================================================*/
+int mfs_host_mount(
+  const char *image,		/* image file */
+  int rdonly			/* mount read-only? */
+)
+{
+  static char label[] = "host";
+  message m;
+  int r;
+
+  if ((image_fd = open(image, rdonly ? O_RDONLY : O_RDWR)) < 0)
+	return(errno);
+  host_dev_attach(HOST_DEV, image_fd);
+
+  init_inode_cache();
+  lmfs_buf_pool(0);
+  caller_uid = SU_UID;
+  caller_gid = 0;
+
+  memset(&m, 0, sizeof(m));
+  m.m_vfs_fs_readsuper.device = HOST_DEV;
+  m.m_vfs_fs_readsuper.grant = host_grant(label, sizeof(label));
+  m.m_vfs_fs_readsuper.path_len = sizeof(label);
+  m.m_vfs_fs_readsuper.flags = REQ_ISROOT | (rdonly ? REQ_RDONLY : 0);
+
+  if ((r = mfs_host_request(REQ_READSUPER, &m)) != OK) {
+	close(image_fd);
+	image_fd = -1;
+	return(r);
+  }
+  root_ino = m.m_fs_vfs_readsuper.inode;
+
+  /* Replay the journal before the first request, as fs_readsuper() has to;
+   * this does nothing if it did.
+   */
+  jr_open(HOST_DEV);
+  return(OK);
+}
+
+/*===========================================================================*
+ *				mfs_host_unmount			     *
+ *===========================================================================*/
+int mfs_host_unmount(void)
+{
+  message m;
+  int r;
+
+  jr_close();
+  memset(&m, 0, sizeof(m));
+  if ((r = mfs_host_request(REQ_UNMOUNT, &m)) != OK) return(r);
+  lmfs_flushall();
+  close(image_fd);
+  image_fd = -1;
+  return(OK);
+}
+
+/*===========================================================================*
+ *				mfs_host_crash				     *
+ *===========================================================================*/
+void mfs_host_crash(void)
+{
+/* Drop the blocks and close the image; the inodes in the table are never
+ * written either.  Only a new mount (after init_inode_cache()) may follow.
+ */
+  lmfs_invalidate(HOST_DEV);
+  close(image_fd);
+  image_fd = -1;
+}
+
+int mfs_host_sync(void)
+{
+  message m;
+
+  memset(&m, 0, sizeof(m));
+  return(mfs_host_request(REQ_SYNC, &m));
+}
+
+/*===========================================================================*
+ *				resolve					     *
+ *===========================================================================*/
+static int resolve(
+  const char *path,		/* path relative to the root */
+  int parent,			/* stop at the last directory? */
+  ino_t *inop,			/* the inode found */
+  char *last			/* if parent, the last component */
+)
+{
+/* Walk the path like VFS does with REQ_LOOKUP, one component at a time.
+ * Mount points and symbolic links are not followed.
+ */
+  struct inode *dirp, *rip;
+  char string[MFS_NAME_MAX + 1];
+  const char *cp, *end;
+  size_t len;
+
+  if ((dirp = get_inode(fs_dev, root_ino)) == NULL) return(err_code);
+
+  for (cp = path; ; cp = end) {
+	while (*cp == '/') cp++;
+	for (end = cp; *end != '\0' && *end != '/'; end++) ;
+	len = end - cp;
+	if (len == 0) break;
+	if (len > MFS_NAME_MAX) {
+		put_inode(dirp);
+		return(ENAMETOOLONG);
+	}
+	memcpy(string, cp, len);
+	string[len] = '\0';
+
+	/* Keep the last component for the caller? */
+	if (parent) {
+		const char *rest = end;
+		while (*rest == '/') rest++;
+		if (*rest == '\0') {
+			strcpy(last, string);
+			*inop = dirp->i_num;
+			put_inode(dirp);
+			return(OK);
+		}
+	}
+
+	rip = advance(dirp, string, IGN_PERM);
+	put_inode(dirp);
+	if (rip == NULL) return(err_code);
+	dirp = rip;
+  }
+
+  if (parent) {
+	put_inode(dirp);
+	return(EINVAL);
+  }
+  *inop = dirp->i_num;
+  put_inode(dirp);
+  return(OK);
+}
+
+/*===========================================================================*
+ *				dir_request				     *
+ *===========================================================================*/
+static int dir_request(
+  int req,			/* REQ_CREATE, REQ_MKDIR, REQ_UNLINK, REQ_RMDIR */
+  const char *path,
+  mode_t mode			/* for REQ_CREATE and REQ_MKDIR */
+)
+{
+/* The requests that name one entry of one directory. */
+  char name[MFS_NAME_MAX + 1];
+  message m;
+  ino_t dir;
+  int r;
+
+  if ((r = resolve(path, TRUE, &dir, name)) != OK) return(r);
+
+  memset(&m, 0, sizeof(m));
+  switch (req) {
+  case REQ_CREATE:
+	m.m_vfs_fs_create.inode = dir;
+	m.m_vfs_fs_create.mode = mode;
+	m.m_vfs_fs_create.uid = caller_uid;
+	m.m_vfs_fs_create.gid = caller_gid;
+	m.m_vfs_fs_create.grant = host_grant(name, strlen(name) + 1);
+	m.m_vfs_fs_create.path_len = strlen(name) + 1;
+	break;
+  case REQ_MKDIR:
+	m.m_vfs_fs_mkdir.inode = dir;
+	m.m_vfs_fs_mkdir.mode = mode;
+	m.m_vfs_fs_mkdir.uid = caller_uid;
+	m.m_vfs_fs_mkdir.gid = caller_gid;
+	m.m_vfs_fs_mkdir.grant = host_grant(name, strlen(name) + 1);
+	m.m_vfs_fs_mkdir.path_len = strlen(name) + 1;
+	break;
+  default:
+	m.m_vfs_fs_unlink.inode = dir;
+	m.m_vfs_fs_unlink.grant = host_grant(name, strlen(name) + 1);
+	m.m_vfs_fs_unlink.path_len = strlen(name) + 1;
+	break;
+  }
+
+  if ((r = mfs_host_request(req, &m)) != OK) return(r);
+
+  /* Give back the reference REQ_CREATE hands to VFS. */
+  if (req == REQ_CREATE) {
+	ino_t ino = m.m_fs_vfs_create.inode;
+
+	memset(&m, 0, sizeof(m));
+	m.m_vfs_fs_putnode.inode = ino;
+	m.m_vfs_fs_putnode.count = 1;
+	r = mfs_host_request(REQ_PUTNODE, &m);
+  }
+  return(r);
+}
+
+int mfs_host_create(const char *path, mode_t mode)
+{
+  return(dir_request(REQ_CREATE, path, I_REGULAR | (mode & ALL_MODES)));
+}
+
+int mfs_host_mkdir(const char *path, mode_t mode)
+{
+  return(dir_request(REQ_MKDIR, path, I_DIRECTORY | (mode & ALL_MODES)));
+}
+
+int mfs_host_unlink(const char *path)
+{
+  return(dir_request(REQ_UNLINK, path, 0));
+}
+
+int mfs_host_rmdir(const char *path)
+{
+  return(dir_request(REQ_RMDIR, path, 0));
+}
+
+/*===========================================================================*
+ *				mfs_host_write				     *
+ *===========================================================================*/
+int mfs_host_write(const char *path, off_t pos, const void *buf, size_t len)
+{
+/* Write and truncate find the inode with find_inode(), so it has to be in
+ * use: hold it for the length of the request, as VFS does.
+ */
+  struct inode *rip;
+  message m;
+  ino_t ino;
+  int r;
+
+  if ((r = resolve(path, FALSE, &ino, NULL)) != OK) return(r);
+  if ((rip = get_inode(fs_dev, ino)) == NULL) return(err_code);
+
+  memset(&m, 0, sizeof(m));
+  m.m_vfs_fs_readwrite.inode = ino;
+  m.m_vfs_fs_readwrite.seek_pos = pos;
+  m.m_vfs_fs_readwrite.grant = host_grant(__UNCONST(buf), len);
+  m.m_vfs_fs_readwrite.nbytes = len;
+  r = mfs_host_request(REQ_WRITE, &m);
+
+  put_inode(rip);
+  return(r);
+}
+
+/*===========================================================================*
+ *				mfs_host_truncate			     *
+ *===========================================================================*/
+int mfs_host_truncate(const char *path, off_t size)
+{
+  struct inode *rip;
+  message m;
+  ino_t ino;
+  int r;
+
+  if ((r = resolve(path, FALSE, &ino, NULL)) != OK) return(r);
+  if ((rip = get_inode(fs_dev, ino)) == NULL) return(err_code);
+
+  memset(&m, 0, sizeof(m));
+  m.m_vfs_fs_ftrunc.inode = ino;
+  m.m_vfs_fs_ftrunc.trc_start = size;
+  m.m_vfs_fs_ftrunc.trc_end = 0;
+  r = mfs_host_request(REQ_FTRUNC, &m);
+
+  put_inode(rip);
+  return(r);
+}
+
+/*===========================================================================*
+ *				mfs_host_compact			     *
+ *===========================================================================*/
+int mfs_host_compact(const char *dir)
+{
+  struct inode *rip;
+  message m;
+  ino_t ino;
+  int r;
+
+  if ((r = resolve(dir, FALSE, &ino, NULL)) != OK) return(r);
+  if ((rip = get_inode(fs_dev, ino)) == NULL) return(err_code);
+
+  memset(&m, 0, sizeof(m));
+  m.m_vfs_fs_ftrunc.inode = ino;
+  r = mfs_host_request(REQ_MFS_COMPACT, &m);
+
+  put_inode(rip);
+  return(r);
+}
+
+/*===========================================================================*
+ *				mfs_host_rmtree				     *
+ *===========================================================================*/
+int mfs_host_rmtree(const char *path, struct mfs_rmtree *rt)
+{
+  char name[MFS_NAME_MAX + 1];
+  message m;
+  ino_t dir;
+  int r;
+
+  if ((r = resolve(path, TRUE, &dir, name)) != OK) return(r);
+
+  memset(rt, 0, sizeof(*rt));
+  strncpy(rt->rt_name, name, sizeof(rt->rt_name));
+  memset(&m, 0, sizeof(m));
+  m.m_vfs_fs_getdents.inode = dir;
+  m.m_vfs_fs_getdents.grant = host_grant(rt, sizeof(*rt));
+  m.m_vfs_fs_getdents.mem_size = sizeof(*rt);
+  return(mfs_host_request(REQ_RMTREE, &m));
+}
+
+/*===========================================================================*
+ *				mfs_host_copytree			     *
+ *===========================================================================*/
+int mfs_host_copytree(const char *from, const char *to,
+	struct mfs_copytree *ct)
+{
+  char src_name[MFS_NAME_MAX + 1], dst_name[MFS_NAME_MAX + 1];
+  message m;
+  ino_t src_dir, dst_dir;
+  int r;
+
+  if ((r = resolve(from, TRUE, &src_dir, src_name)) != OK) return(r);
+  if ((r = resolve(to, TRUE, &dst_dir, dst_name)) != OK) return(r);
+
+  memset(ct, 0, sizeof(*ct));
+  ct->ct_dst_dir = dst_dir;
+  strncpy(ct->ct_src_name, src_name, sizeof(ct->ct_src_name));
+  strncpy(ct->ct_dst_name, dst_name, sizeof(ct->ct_dst_name));
+  memset(&m, 0, sizeof(m));
+  m.m_vfs_fs_getdents.inode = src_dir;
+  m.m_vfs_fs_getdents.grant = host_grant(ct, sizeof(*ct));
+  m.m_vfs_fs_getdents.mem_size = sizeof(*ct);
+  return(mfs_host_request(REQ_COPYTREE, &m));
+}
+
+/*===========================================================================*
+ *				mfs_host_clone				     *
+ *===========================================================================*/
+int mfs_host_clone(const char *from, const char *to)
+{
+  char name[MFS_NAME_MAX + 1];
+  ino_t ino, dir;
+  message m;
+  int r;
+
+  if ((r = resolve(from, FALSE, &ino, NULL)) != OK) return(r);
+  if ((r = resolve(to, TRUE, &dir, name)) != OK) return(r);
+
+  memset(&m, 0, sizeof(m));
+  m.m_vfs_fs_link.inode = ino;
+  m.m_vfs_fs_link.dir_ino = dir;
+  m.m_vfs_fs_link.grant = host_grant(name, strlen(name) + 1);
+  m.m_vfs_fs_link.path_len = strlen(name) + 1;
+  return(mfs_host_request(REQ_CLONE, &m));
+}
+
+/*===========================================================================*
+ *				mfs_host_rename				     *
+ *===========================================================================*/
+int mfs_host_rename(const char *from, const char *to, int flags)
+{
+  char old_name[MFS_NAME_MAX + 1], new_name[MFS_NAME_MAX + 1];
+  ino_t old_dir, new_dir;
+  message m;
+  int r;
+
+  if ((r = resolve(from, TRUE, &old_dir, old_name)) != OK) return(r);
+  if ((r = resolve(to, TRUE, &new_dir, new_name)) != OK) return(r);
+
+  memset(&m, 0, sizeof(m));
+  m.m_vfs_fs_rename.dir_old = old_dir;
+  m.m_vfs_fs_rename.grant_old = host_grant(old_name, strlen(old_name) + 1);
+  m.m_vfs_fs_rename.len_old = strlen(old_name) + 1;
+  m.m_vfs_fs_rename.dir_new = new_dir;
+  m.m_vfs_fs_rename.grant_new = host_grant(new_name, strlen(new_name) + 1);
+  m.m_vfs_fs_rename.len_new = strlen(new_name) + 1;
+  MFS_RENAME_FLAGS(&m) = flags;
+  return(mfs_host_request(REQ_RENAME, &m));
+}
+
+/*===========================================================================*
+ *				mfs_host_link				     *
+ *===========================================================================*/
+int mfs_host_link(const char *from, const char *to)
+{
+  char name[MFS_NAME_MAX + 1];
+  ino_t ino, dir;
+  message m;
+  int r;
+
+  if ((r = resolve(from, FALSE, &ino, NULL)) != OK) return(r);
+  if ((r = resolve(to, TRUE, &dir, name)) != OK) return(r);
+
+  memset(&m, 0, sizeof(m));
+  m.m_vfs_fs_link.inode = ino;
+  m.m_vfs_fs_link.dir_ino = dir;
+  m.m_vfs_fs_link.grant = host_grant(name, strlen(name) + 1);
+  m.m_vfs_fs_link.path_len = strlen(name) + 1;
+  return(mfs_host_request(REQ_LINK, &m));
+}
+
+/*===========================================================================*
+ *				mfs_host_stat				     *
+ *===========================================================================*/
+int mfs_host_stat(const char *path, struct stat *st)
+{
+  message m;
+  ino_t ino;
+  int r;
+
+  if ((r = resolve(path, FALSE, &ino, NULL)) != OK) return(r);
+
+  memset(&m, 0, sizeof(m));
+  m.m_vfs_fs_stat.inode = ino;
+  m.m_vfs_fs_stat.grant = host_grant(st, sizeof(*st));
+  return(mfs_host_request(REQ_STAT, &m));
+}
+
+int mfs_host_statvfs(struct statvfs *st)
+{
+  message m;
+
+  memset(&m, 0, sizeof(m));
+  m.m_vfs_fs_statvfs.grant = host_grant(st, sizeof(*st));
+  return(mfs_host_request(REQ_STATVFS, &m));
+}
@@ -0,0 +1,80 @@
+/* Host API of the MFS core.
+ *
+ * Each call plays the part of VFS: it resolves the path itself, fills in the
+ * request message and calls the MFS handler directly, in this process.  All
+ * paths are relative to the root of the mounted image.  The calls return OK
+ * or an error code, as the handlers do.
+ */
+#ifndef _MFS_HOST_H
+#define _MFS_HOST_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <stdint.h>
+
+/* Device number the image is mounted as. */
+#define HOST_DEV	((dev_t) 0x0301)
+
+int mfs_host_mount(const char *image, int rdonly);
+int mfs_host_unmount(void);
+int mfs_host_sync(void);
+
+/* Stop as a power cut would: nothing still cached gets to the image, and
+ * the image is left as the next mount finds it.
+ */
+void mfs_host_crash(void);
+
+int mfs_host_create(const char *path, mode_t mode);
+int mfs_host_mkdir(const char *path, mode_t mode);
+int mfs_host_write(const char *path, off_t pos, const void *buf,
+	size_t len);
+int mfs_host_truncate(const char *path, off_t size);
+int mfs_host_unlink(const char *path);
+int mfs_host_rmdir(const char *path);
+int mfs_host_rename(const char *from, const char *to, int flags);
+int mfs_host_link(const char *from, const char *to);
+int mfs_host_stat(const char *path, struct stat *st);
+int mfs_host_statvfs(struct statvfs *st);
+int mfs_host_compact(const char *dir);
+
+/* Remove a tree; what stayed is counted in *rt (see <minix/mfsif.h>). */
+struct mfs_rmtree;
+int mfs_host_rmtree(const char *path, struct mfs_rmtree *rt);
+
+/* Copy a tree to a new path; what was copied is counted in *ct. */
+struct mfs_copytree;
+int mfs_host_copytree(const char *from, const char *to,
+	struct mfs_copytree *ct);
+
+/* Make 'to' a clone of the file 'from', sharing its zones (needs ZONE_COW). */
+int mfs_host_clone(const char *from, const char *to);
+
+/* Inode cache hits and misses since the mount. */
+void mfs_host_icache(uint64_t *hits, uint64_t *misses);
+
+/* Name cache hits (either way) and misses since the mount. */
+void mfs_host_names(uint64_t *hits, uint64_t *misses);
+
+/* The generation of the cached inherited modes (mode_gen in inode.h). */
+unsigned int mfs_host_mode_gen(void);
+
+/* Drain the inode cache trace (MFS built with INODE_TRACE) into buf. */
+int mfs_host_trace(void *buf, size_t len, size_t *used);
+
+/* Blocks read from and written to the image since the mount. */
+extern uint64_t host_blocks_read, host_blocks_written;
+
+#ifdef _MINIX_HOST
+#include <minix/ipc.h>
+
+/* Send one raw request; the message is the request in and the reply out. */
+int mfs_host_request(int req, message *m);
+
+/* Glue used by ipc.c and blockdev.c. */
+int host_grant(void *addr, size_t len);
+void host_ungrant(void);
+void host_dev_attach(dev_t dev, int fd);
+#endif
+
+#endif /* _MFS_HOST_H */
@@ -0,0 +1,259 @@
+/* This file keeps the name cache: what a name in a directory refers to, or
+ * that it is not there.
+ *
+ * Entries are checked, not searched out and removed, when a directory
+ * changes.  Every in-core inode has two generation numbers: i_dcload, given
+ * when it is read in, and i_dcgen, given anew whenever a name is entered in
+ * the directory.  A positive entry is good while its directory keeps the
+ * i_dcload it was made at; the entry is removed when its name is deleted or
+ * renamed, which is always done in link.c.  A negative entry is good while
+ * its directory keeps the i_dcgen it was made at, since deletions cannot
+ * make a missing name appear.  Generations come from one 64-bit counter and
+ * are never reused.
+ *
+ * Names entered by code that does not call dc_entered(), search_dir() ENTER
+ * from open.c, are covered by IN_MARKDIRTY(): it sets the directory's i_dcgen
+ * to 0, which no entry has, so only that directory's negative entries go.
+ *
+ * The table is set associative; a full set gives up its least recently
+ * used entry.
+ *
+ * The entry points into this file are
+ *   dc_init:    empty the cache
+ *   dc_new_dir: give an inode just read in new generations
+ *   dc_search:  search_dir() LOOK_UP through the cache
+ *   dc_advance: advance() through the cache
+ *   dc_entered: a name was entered in a directory
+ *   dc_deleted: a name was deleted from a directory
+ */
+
+#include "fs.h"
+#include <string.h>
+#include "inode.h"
+#include "dcache.h"
+
+#define DC_SETS		256	/* a power of two */
+#define DC_WAYS		4
+
+static struct dentry {
+  dev_t d_dev;			/* device of the directory */
+  ino_t d_dir;			/* the directory */
+  ino_t d_ino;			/* what the name refers to, or NO_ENTRY */
+  u64_t d_gen;			/* directory generation it was made at */
+  u64_t d_used;			/* dc_clock at the last use */
+  char d_name[MFS_NAME_MAX];	/* NUL padded, like a directory entry */
+} dcache[DC_SETS][DC_WAYS];
+
+struct mfs_name_stat dc_stats;
+
+static u64_t dc_gen;		/* last generation handed out */
+static u64_t dc_clock;		/* for the LRU within a set */
+
+static unsigned int dc_hash(struct inode *dirp, const char *name);
+static int dc_valid(struct dentry *dp, struct inode *dirp);
+static struct dentry *dc_find(struct inode *dirp, const char *name);
+static void dc_insert(struct inode *dirp, const char *name, ino_t numb);
+
+/*===========================================================================*
+ *				dc_init					     *
+ *===========================================================================*/
+void dc_init(void)
+{
+  memset(dcache, 0, sizeof(dcache));
+  memset(&dc_stats, 0, sizeof(dc_stats));
+  dc_gen = dc_clock = 0;
+}
+
+/*===========================================================================*
+ *				dc_new_dir				     *
+ *===========================================================================*/
+void dc_new_dir(struct inode *dirp)
+{
+  dirp->i_dcload = dirp->i_dcgen = ++dc_gen;
+}
+
+/*===========================================================================*
+ *				dc_hash					     *
+ *===========================================================================*/
+static unsigned int dc_hash(struct inode *dirp, const char *name)
+{
+  unsigned int h;
+  int i;
+
+  h = (unsigned int) dirp->i_num * 2654435761U;
+  for (i = 0; i < MFS_NAME_MAX && name[i] != '\0'; i++)
+	h = h * 31 + (unsigned char) name[i];
+  return(h & (DC_SETS - 1));
+}
+
+/*===========================================================================*
+ *				dc_valid				     *
+ *===========================================================================*/
+static int dc_valid(struct dentry *dp, struct inode *dirp)
+{
+/* Is the entry, if it is for 'dirp', still good? */
+  if (dp->d_ino != NO_ENTRY)
+	return(dp->d_gen == dirp->i_dcload);
+  return(dp->d_gen == dirp->i_dcgen);
+}
+
+/*===========================================================================*
+ *				dc_find					     *
+ *===========================================================================*/
+static struct dentry *dc_find(struct inode *dirp, const char *name)
+{
+  struct dentry *dp;
+  unsigned int set;
+
+  set = dc_hash(dirp, name);
+  for (dp = dcache[set]; dp < &dcache[set][DC_WAYS]; dp++) {
+	if (dp->d_gen != 0 && dp->d_dir == dirp->i_num &&
+	    dp->d_dev == dirp->i_dev && dc_valid(dp, dirp) &&
+	    strncmp(dp->d_name, name, MFS_NAME_MAX) == 0)
+		return(dp);
+  }
+  return(NULL);
+}
+
+/*===========================================================================*
+ *				dc_insert				     *
+ *===========================================================================*/
+static void dc_insert(
+  struct inode *dirp,		/* directory the name is looked up in */
+  const char *name,		/* the name */
+  ino_t numb			/* what it refers to, or NO_ENTRY */
+)
+{
+  struct dentry *dp, *victim;
+  unsigned int set;
+
+  if ((victim = dc_find(dirp, name)) == NULL) {
+	/* Take an empty entry, or else the least recently used. */
+	set = dc_hash(dirp, name);
+	victim = &dcache[set][0];
+	for (dp = dcache[set]; dp < &dcache[set][DC_WAYS]; dp++) {
+		if (dp->d_gen == 0) {
+			victim = dp;
+			break;
+		}
+		if (dp->d_used < victim->d_used) victim = dp;
+	}
+	if (dp == &dcache[set][DC_WAYS]) dc_stats.ns_evictions++;
+  }
+
+  /* A negative entry needs a generation, which IN_MARKDIRTY() may have
+   * taken away.
+   */
+  if (numb == NO_ENTRY && dirp->i_dcgen == 0)
+	dirp->i_dcgen = ++dc_gen;
+
+  victim->d_dev = dirp->i_dev;
+  victim->d_dir = dirp->i_num;
+  victim->d_ino = numb;
+  victim->d_gen = (numb == NO_ENTRY ? dirp->i_dcgen : dirp->i_dcload);
+  victim->d_used = ++dc_clock;
+  strncpy(victim->d_name, name, MFS_NAME_MAX);
+}
+
+/*===========================================================================*
+ *				dc_search				     *
+ *===========================================================================*/
+int dc_search(
+  struct inode *dirp,		/* directory to search */
+  char *name,			/* name to look up */
+  ino_t *numb			/* where to put its inode number */
+)
+{
+/* Do what search_dir(dirp, name, numb, LOOK_UP, IGN_PERM) does, from the
+ * cache if possible.
+ */
+  struct dentry *dp;
+  int r;
+
+  if (name[0] != '\0' && (dp = dc_find(dirp, name)) != NULL) {
+	dp->d_used = ++dc_clock;
+	if (dp->d_ino == NO_ENTRY) {
+		dc_stats.ns_neg_hits++;
+		return(ENOENT);
+	}
+	dc_stats.ns_hits++;
+	*numb = dp->d_ino;
+	return(OK);
+  }
+
+  dc_stats.ns_misses++;
+  r = search_dir(dirp, name, numb, LOOK_UP, IGN_PERM);
+  if (name[0] != '\0') {
+	if (r == OK) dc_insert(dirp, name, *numb);
+	else if (r == ENOENT) dc_insert(dirp, name, NO_ENTRY);
+  }
+  return(r);
+}
+
+/*===========================================================================*
+ *				dc_advance				     *
+ *===========================================================================*/
+struct inode *dc_advance(
+  struct inode *dirp,		/* inode for directory to be searched */
+  char *name			/* component name to look for */
+)
+{
+/* Do what advance(dirp, name, IGN_PERM) does, from the cache if possible.
+ * Mount points and the root are left to advance(), which reports them.
+ */
+  struct inode *rip;
+  struct dentry *dp;
+
+  if (dirp == NULL || name[0] == '\0') return(advance(dirp, name, IGN_PERM));
+
+  if ((dp = dc_find(dirp, name)) != NULL) {
+	dp->d_used = ++dc_clock;
+	if (dp->d_ino == NO_ENTRY) {
+		dc_stats.ns_neg_hits++;
+		err_code = ENOENT;
+		return(NULL);
+	}
+	if ((rip = get_inode(dirp->i_dev, dp->d_ino)) == NULL)
+		return(NULL);
+	if (!rip->i_mountpoint) {
+		dc_stats.ns_hits++;
+		err_code = OK;
+		return(rip);
+	}
+	put_inode(rip);		/* mounted on since: take the long way */
+  }
+
+  dc_stats.ns_misses++;
+  rip = advance(dirp, name, IGN_PERM);
+  if (rip != NULL) {
+	if (err_code == OK && rip->i_num != ROOT_INODE && !rip->i_mountpoint)
+		dc_insert(dirp, name, rip->i_num);
+  } else if (err_code == ENOENT) {
+	dc_insert(dirp, name, NO_ENTRY);
+  }
+  return(rip);
+}
+
+/*===========================================================================*
+ *				dc_entered				     *
+ *===========================================================================*/
+void dc_entered(
+  struct inode *dirp,		/* directory a name was entered in */
+  const char *name,		/* the name */
+  ino_t numb			/* what it refers to */
+)
+{
+  dirp->i_dcgen = ++dc_gen;	/* negative entries are stale now */
+  dc_insert(dirp, name, numb);
+}
+
+/*===========================================================================*
+ *				dc_deleted				     *
+ *===========================================================================*/
+void dc_deleted(
+  struct inode *dirp,		/* directory a name was deleted from */
+  const char *name		/* the name */
+)
+{
+  dc_insert(dirp, name, NO_ENTRY);
+}
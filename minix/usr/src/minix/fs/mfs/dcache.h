@@ -0,0 +1,25 @@
+#ifndef __MFS_DCACHE_H__
+#define __MFS_DCACHE_H__
+
+/* Name cache: a bounded table of (directory, name) -> inode translations,
+ * and of names known not to be in a directory, so that looking a name up
+ * again does not scan the directory.  Only the lookups made in link.c go
+ * through it; REQ_LOOKUP and the other users of advance() in path.c do
+ * not.  See dcache.c.
+ */
+
+#include <minix/mfsif.h>
+
+struct inode;
+
+/* hit and miss counts, copied out by REQ_MFS_STATS */
+extern struct mfs_name_stat dc_stats;
+
+void dc_init(void);
+void dc_new_dir(struct inode *dirp);
+int dc_search(struct inode *dirp, char *name, ino_t *numb);
+struct inode *dc_advance(struct inode *dirp, char *name);
+void dc_entered(struct inode *dirp, const char *name, ino_t numb);
+void dc_deleted(struct inode *dirp, const char *name);
+
+#endif
@@ -7,6 +7,11 @@
 #define _SYSTEM		1	/* tell headers that this is the kernel */
 
 #define VERBOSE		0	/* show messages during initialization? */
+#define REQ_STATS	0	/* time requests, see reqstats.h */
+#define INODE_TRACE	0	/* log inode cache events, see trace.h */
+#define INODE_2Q	1	/* keep reused inodes apart, see put_inode */
+#define ZONE_COW	0	/* REQ_CLONE, once read.c unshares, see zref.h */
+#define SUBSEC_TIMES	0	/* sub-second m/ctime on disk, see inode.h */
 
 #define BMODE ((uint32_t)INT32_MAX + 1)
 
@@ -29,6 +34,7 @@
 #include "const.h"
 #include "type.h"
 #include "proto.h"
+#include "mfsproto.h"
 #include "glo.h"
 
 #endif
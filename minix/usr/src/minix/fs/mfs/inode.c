@@ -7,6 +7,7 @@
  *                 read it
  *   put_inode:	   indicate that an inode is no longer needed in memory
  *   alloc_inode:  allocate a new, unused inode
+ *   alloc_inode_near: the same, close to a given inode
  *   wipe_inode:   erase some fields of a newly allocated inode
  *   free_inode:   mark an inode as available for a new file
  *   update_times: update atime, ctime, and mtime
@@ -20,10 +21,16 @@
 #include "buf.h"
 #include "inode.h"
 #include "super.h"
+#include "trace.h"
+#include "dcache.h"
+#include "journal.h"
 #include <minix/vfsif.h>
 #include <assert.h>
 
 static void addhash_inode(struct inode *node);
+static void unused_remove(struct inode *rip);
+
+static void clock_now(time_t *sec, u32_t *nsec);
 
 static void free_inode(dev_t dev, ino_t numb);
 static void new_icopy(struct inode *rip, d2_inode *dip, int direction,
@@ -80,9 +87,16 @@ void init_inode_cache()
 
   inode_cache_hit = 0;
   inode_cache_miss = 0;
+  mode_gen = 0;
+  live_gen = 0;
+  keep_orphans = FALSE;
+  dc_init();
+  jr_init();
 
-  /* init free/unused list */
+  /* init free/unused lists */
   TAILQ_INIT(&unused_inodes);
+  TAILQ_INIT(&unused_hot);
+  nr_unused_hot = 0;
   
   /* init hash lists */
   for (rlp = &hash_inodes[0]; rlp < &hash_inodes[INODE_HASH_SIZE]; ++rlp) 
@@ -91,6 +105,7 @@ void init_inode_cache()
   /* add free inodes to unused/free list */
   for (rip = &inode[0]; rip < &inode[NR_INODES]; ++rip) {
       rip->i_num = NO_ENTRY;
+      rip->i_hot = FALSE;
       TAILQ_INSERT_HEAD(&unused_inodes, rip, i_unused);
   }
 }
@@ -118,6 +133,21 @@ static void unhash_inode(struct inode *node)
 }
 
 
+/*===========================================================================*
+ *				unused_remove				     *
+ *===========================================================================*/
+static void unused_remove(struct inode *rip)
+{
+  /* take an unused inode off whichever unused list it is on */
+  if (rip->i_hot) {
+      TAILQ_REMOVE(&unused_hot, rip, i_unused);
+      nr_unused_hot--;
+  } else {
+      TAILQ_REMOVE(&unused_inodes, rip, i_unused);
+  }
+}
+
+
 /*===========================================================================*
  *				get_inode				     *
  *===========================================================================*/
@@ -137,41 +167,65 @@ struct inode *get_inode(
   /* Search inode in the hash table */
   LIST_FOREACH(rip, &hash_inodes[hashi], i_hash) {
       if (rip->i_num == numb && rip->i_dev == dev) {
-          /* If unused, remove it from the unused/free list */
+          /* If unused, remove it from the unused/free list.  Being
+           * asked for again after it was released makes it hot.
+           */
           if (rip->i_count == 0) {
 	      inode_cache_hit++;
-              TAILQ_REMOVE(&unused_inodes, rip, i_unused);
+              unused_remove(rip);
+              rip->i_hot = INODE_2Q;
 	  }
           ++rip->i_count;
+          TRACE(MFS_TR_HIT, dev, numb);
           return(rip);
       }
   }
 
   inode_cache_miss++;
 
-  /* Inode is not on the hash, get a free one */
-  if (TAILQ_EMPTY(&unused_inodes)) {
+  /* Inode is not on the hash, get a free one; take a hot one only if
+   * there is nothing else.
+   */
+  if ((rip = TAILQ_FIRST(&unused_inodes)) == NULL &&
+      (rip = TAILQ_FIRST(&unused_hot)) == NULL) {
       err_code = ENFILE;
       return(NULL);
   }
-  rip = TAILQ_FIRST(&unused_inodes);
 
   /* If not free unhash it */
-  if (rip->i_num != NO_ENTRY)
+  if (rip->i_num != NO_ENTRY) {
+      TRACE(MFS_TR_EVICT, rip->i_dev, rip->i_num);
       unhash_inode(rip);
+  }
+
+  /* Subdirectories may have inherited their mode from this one; once it is
+   * gone from the table nobody can tell them about a change, so forget all.
+   */
+  if (rip->i_mode_dep)
+      mode_gen++;
   
   /* Inode is not unused any more */
-  TAILQ_REMOVE(&unused_inodes, rip, i_unused);
+  unused_remove(rip);
+  rip->i_hot = FALSE;
 
   /* Load the inode. */
   rip->i_dev = dev;
   rip->i_num = numb;
   rip->i_count = 1;
+  TRACE(MFS_TR_MISS, dev, numb);
   if (dev != NO_DEV) rw_inode(rip, READING);	/* get inode from disk */
   rip->i_update = 0;		/* all the times are initially up-to-date */
   rip->i_zsearch = NO_ZONE;	/* no zones searched for yet */
   rip->i_mountpoint= FALSE;
   rip->i_last_dpos = 0;		/* no dentries searched for yet */
+  rip->i_parent = NO_ENTRY;	/* ".." not searched for yet */
+  rip->i_nr_free = 0;		/* free slots not known yet */
+  rip->i_free_all = FALSE;
+  rip->i_nr_live = -1;		/* entries not counted yet */
+  rip->i_lmode = NO_MODE_CACHED;	/* mode files not searched for yet */
+  rip->i_imode = NO_MODE_CACHED;
+  rip->i_mode_dep = FALSE;
+  dc_new_dir(rip);		/* nothing cached for it is current */
 
   /* Add to hash */
   addhash_inode(rip);
@@ -223,8 +277,13 @@ register struct inode *rip;	/* pointer to inode to be released */
 	panic("put_inode: i_count already below 1: %d", rip->i_count);
 
   if (--rip->i_count == 0) {	/* i_count == 0 means no one is using it now */
-	if (rip->i_nlinks == NO_LINK) {
+	if (rip->i_nlinks == NO_LINK && !keep_orphans) {
 		/* i_nlinks == NO_LINK means free the inode. */
+		/* The journal cannot bring it back, so what unlinked it has
+		 * to be done for good first.
+		 */
+		jr_commit();
+
 		/* return all the disk blocks */
 
 		/* Ignore errors by truncate_inode in case inode is a block
@@ -237,15 +296,35 @@ register struct inode *rip;	/* pointer to inode to be released */
 	} 
 
         rip->i_mountpoint = FALSE;
-	if (IN_ISDIRTY(rip)) rw_inode(rip, WRITING);
+	if (rip->i_update) update_times(rip);	/* may dirty the inode */
+	if (IN_ISDIRTY(rip)) {
+		TRACE(MFS_TR_WRITEBACK, rip->i_dev, rip->i_num);
+		rw_inode(rip, WRITING);
+	}
 
-	if (rip->i_nlinks == NO_LINK) {
+	if (rip->i_nlinks == NO_LINK && !keep_orphans) {
 		/* free, put at the front of the LRU list */
 		unhash_inode(rip);
 		rip->i_num = NO_ENTRY;
+		rip->i_hot = FALSE;
 		TAILQ_INSERT_HEAD(&unused_inodes, rip, i_unused);
+	} else if (rip->i_hot) {
+		/* used more than once, put at the back of the hot LRU.  Keep
+		 * the hot list from taking the whole table, so that inodes
+		 * used once still get some time to be used again.
+		 */
+		TAILQ_INSERT_TAIL(&unused_hot, rip, i_unused);
+		if (++nr_unused_hot > HOT_INODES_MAX) {
+			struct inode *oldest = TAILQ_FIRST(&unused_hot);
+
+			unused_remove(oldest);
+			oldest->i_hot = FALSE;
+			TAILQ_INSERT_TAIL(&unused_inodes, oldest, i_unused);
+		}
 	} else {
-		/* unused, put at the back of the LRU (cache it) */
+		/* unused, put at the back of the LRU (cache it).  A scan
+		 * that reads every inode once only ever cycles this list.
+		 */
 		TAILQ_INSERT_TAIL(&unused_inodes, rip, i_unused);
 	}
   }
@@ -261,8 +340,8 @@ struct inode *alloc_inode(dev_t dev, mode_t bits)
 
   register struct inode *rip;
   register struct super_block *sp;
-  int major, minor, inumb;
-  bit_t b;
+  int major, minor, inumb, nskip;
+  bit_t b, skip[JR_SKIP_MAX];
 
   sp = get_super(dev);	/* get pointer to super_block */
   if (sp->s_rd_only) {	/* can't allocate an inode on a read only device. */
@@ -270,8 +349,17 @@ struct inode *alloc_inode(dev_t dev, mode_t bits)
 	return(NULL);
   }
 
-  /* Acquire an inode from the bit map. */
+  /* Acquire an inode from the bit map.  Numbers the journal may still have
+   * records about are passed over while there are others, and given back
+   * once one is found, so that a file just removed costs no checkpoint.
+   */
+  nskip = 0;
   b = alloc_bit(sp, IMAP, sp->s_isearch);
+  while (b != NO_BIT && nskip < JR_SKIP_MAX && jr_reused((ino_t) b)) {
+	skip[nskip++] = b;
+	b = alloc_bit(sp, IMAP, b);
+  }
+  if (b == NO_BIT && nskip > 0) b = skip[--nskip];
   if (b == NO_BIT) {
 	err_code = ENOSPC;
 	major = major(sp->s_dev);
@@ -280,8 +368,12 @@ struct inode *alloc_inode(dev_t dev, mode_t bits)
 	return(NULL);
   }
   sp->s_isearch = b;		/* next time start here */
+  while (nskip > 0) free_bit(sp, IMAP, skip[--nskip]);
   inumb = (int) b;		/* be careful not to pass unshort as param */
 
+  /* The name and links the caller gives it may not be in the journal. */
+  jr_alloc((ino_t) b, bits);
+
   /* Try to acquire a slot in the inode table. */
   if ((rip = get_inode(NO_DEV, inumb)) == NULL) {
 	/* No inode table slots available.  Free the inode just allocated. */
@@ -303,12 +395,43 @@ struct inode *alloc_inode(dev_t dev, mode_t bits)
 	 * not to repeat the code twice.
 	 */
 	wipe_inode(rip);
+
+	/* Nothing the name cache has under this inode number is about
+	 * the new file.  The caller is about to enter a name for it
+	 * somewhere, and not every caller says where, so no entry count
+	 * can be trusted any more.
+	 */
+	dc_new_dir(rip);
+	live_gen++;
   }
 
   return(rip);
 }
 
 
+/*===========================================================================*
+ *				alloc_inode_near			     *
+ *===========================================================================*/
+struct inode *alloc_inode_near(dev_t dev, mode_t bits, ino_t near)
+{
+/* Allocate a free inode on 'dev' like alloc_inode(), but look for one from
+ * 'near' on, so that files made together end up in the same inode blocks.
+ */
+  struct super_block *sp;
+  struct inode *rip;
+  bit_t isearch;
+
+  sp = get_super(dev);
+  isearch = sp->s_isearch;
+  if ((bit_t) near > isearch) sp->s_isearch = (bit_t) near;
+
+  rip = alloc_inode(dev, bits);
+
+  /* Free inodes below 'near' are still to be found from where we were. */
+  if (isearch < sp->s_isearch) sp->s_isearch = isearch;
+  return(rip);
+}
+
 /*===========================================================================*
  *				wipe_inode				     *
  *===========================================================================*/
@@ -323,6 +446,8 @@ register struct inode *rip;	/* the inode to be erased */
   register int i;
 
   rip->i_size = 0;
+  rip->i_mtime_nsec = rip->i_ctime_nsec = 0;
+  rip->i_shared = FALSE;
   rip->i_update = ATIME | CTIME | MTIME;	/* update all times later */
   IN_MARKDIRTY(rip);
   for (i = 0; i < V2_NR_TZONES; i++) rip->i_zone[i] = NO_ZONE;
@@ -361,19 +486,30 @@ register struct inode *rip;	/* pointer to inode to be read/written */
  * task--an expensive business--the times are marked for update by setting
  * bits in i_update.  When a stat, fstat, or sync is done, or an inode is 
  * released, update_times() may be called to actually fill in the times.
+ * Setting ATIME alone need not dirty the inode: if the atime really changes,
+ * update_times() marks the inode dirty itself.
  */
 
   time_t cur_time;
+  u32_t cur_nsec, nsec;
+  u32_t old_time;
+  int changed;
   struct super_block *sp;
 
   sp = rip->i_sp;		/* get pointer to super block. */
   if (sp->s_rd_only) return;	/* no updates for read-only file systems */
 
-  cur_time = clock_time();
-  if (rip->i_update & ATIME) rip->i_atime = cur_time;
-  if (rip->i_update & CTIME) rip->i_ctime = cur_time;
+  clock_now(&cur_time, &cur_nsec);
+  changed = FALSE;
+  if (rip->i_update & CTIME) {
+	nsec = cur_nsec - cur_nsec % CTIME_NSEC_UNIT;
+	changed |= (rip->i_ctime != cur_time || rip->i_ctime_nsec != nsec);
+	rip->i_ctime = cur_time;
+	rip->i_ctime_nsec = nsec;
+  }
   if (rip->i_update & MTIME)
   {
+    old_time = rip->i_mtime;
     if(rip->i_mtime & BMODE)
     {
       rip->i_mtime = cur_time | BMODE;
@@ -382,11 +518,51 @@ register struct inode *rip;	/* pointer to inode to be read/written */
     {
       rip->i_mtime = cur_time;
     }
+    nsec = cur_nsec - cur_nsec % MTIME_NSEC_UNIT;
+    changed |= (rip->i_mtime != old_time || rip->i_mtime_nsec != nsec);
+    rip->i_mtime_nsec = nsec;
+  }
+  /* With relatime, only move an atime that is not past the last change or
+   * is more than a day old, so that reading mostly leaves the inode alone.
+   */
+  if ((rip->i_update & ATIME) && (!relatime ||
+	rip->i_atime <= (rip->i_mtime & (BMODE - 1)) ||
+	rip->i_atime <= rip->i_ctime ||
+	cur_time - (time_t) rip->i_atime >= RELATIME_MAX_AGE)) {
+	changed |= (rip->i_atime != cur_time);
+	rip->i_atime = cur_time;
   }
 
+  /* Write the inode back only if a time really moved.  A time is not a
+   * mode, so the modes cached from this inode stay valid.
+   */
+  if (changed) IN_MARKDIRTY_KEEPMODE(rip);
+
   rip->i_update = 0;		/* they are all up-to-date now */
 }
 
+/*===========================================================================*
+ *				clock_now				     *
+ *===========================================================================*/
+static void clock_now(sec, nsec)
+time_t *sec;			/* current time, in seconds */
+u32_t *nsec;			/* and the nanoseconds on top of it */
+{
+/* Like clock_time(), but to the resolution of the clock tick. */
+
+  clock_t uptime, realtime;
+  time_t boottime;
+  u32_t hz;
+  int r;
+
+  if ((r = getuptime(&uptime, &realtime, &boottime)) != OK)
+	panic("clock_now: getuptime failed: %d", r);
+
+  hz = sys_hz();
+  *sec = boottime + (time_t) (realtime / hz);
+  *nsec = (u32_t) (realtime % hz) * (1000000000 / hz);
+}
+
 /*===========================================================================*
  *				rw_inode				     *
  *===========================================================================*/
@@ -401,6 +577,9 @@ int rw_flag;			/* READING or WRITING */
   d2_inode *dip2;
   block_t b, offset;
 
+  TRACE(rw_flag == WRITING ? MFS_TR_WRITE : MFS_TR_READ, rip->i_dev,
+	rip->i_num);
+
   /* Get the block where the inode resides. */
   sp = get_super(rip->i_dev);	/* get pointer to super block */
   rip->i_sp = sp;		/* inode must contain super block pointer */
@@ -412,6 +591,7 @@ int rw_flag;			/* READING or WRITING */
 
   /* Do the read or write. */
   if (rw_flag == WRITING) {
+	jr_write();			/* link counts are logged first */
 	if (rip->i_update) update_times(rip);	/* times need updating */
 	if (sp->s_rd_only == FALSE) MARKDIRTY(bp);
   }
@@ -436,6 +616,9 @@ int direction;			/* READING (from disk) or WRITING (to disk) */
 int norm;			/* TRUE = do not swap bytes; FALSE = swap */
 {
   int i;
+#if SUBSEC_TIMES || ZONE_COW
+  u32_t nsec;
+#endif
 
   if (direction == READING) {
 	/* Copy V2.x inode to the in-core table, swapping bytes if need be. */
@@ -451,6 +634,25 @@ int norm;			/* TRUE = do not swap bytes; FALSE = swap */
 	rip->i_nindirs = V2_INDIRECTS(rip->i_sp->s_block_size);
 	for (i = 0; i < V2_NR_TZONES; i++)
 		rip->i_zone[i] = (zone_t) conv4(norm, (long) dip->d2_zone[i]);
+	rip->i_mtime_nsec = rip->i_ctime_nsec = 0;
+	rip->i_shared = FALSE;
+#if SUBSEC_TIMES
+	/* Unpack the sub-second times; values that are out of range are left
+	 * from before they were kept and mean 0.
+	 */
+	nsec = rip->i_zone[NSEC_ZONE] & NSEC_MTIME_MASK;
+	if (nsec * MTIME_NSEC_UNIT < 1000000000)
+		rip->i_mtime_nsec = nsec * MTIME_NSEC_UNIT;
+	nsec = (rip->i_zone[NSEC_ZONE] >> NSEC_CTIME_SHIFT) & NSEC_CTIME_MASK;
+	if (nsec * CTIME_NSEC_UNIT < 1000000000)
+		rip->i_ctime_nsec = nsec * CTIME_NSEC_UNIT;
+#endif
+#if ZONE_COW
+	rip->i_shared = !!(rip->i_zone[NSEC_ZONE] & ZONES_SHARED);
+#endif
+#if SUBSEC_TIMES || ZONE_COW
+	rip->i_zone[NSEC_ZONE] = NO_ZONE;
+#endif
   } else {
 	/* Copying V2.x inode to disk from the in-core table. */
 	dip->d2_mode   = (u16_t) conv2(norm,rip->i_mode);
@@ -463,6 +665,17 @@ int norm;			/* TRUE = do not swap bytes; FALSE = swap */
 	dip->d2_mtime  = (i32_t) conv4(norm,rip->i_mtime);
 	for (i = 0; i < V2_NR_TZONES; i++)
 		dip->d2_zone[i] = (zone_t) conv4(norm, (long) rip->i_zone[i]);
+#if SUBSEC_TIMES || ZONE_COW
+	nsec = 0;
+#if SUBSEC_TIMES
+	nsec |= (rip->i_mtime_nsec / MTIME_NSEC_UNIT) |
+		(rip->i_ctime_nsec / CTIME_NSEC_UNIT) << NSEC_CTIME_SHIFT;
+#endif
+#if ZONE_COW
+	if (rip->i_shared) nsec |= ZONES_SHARED;
+#endif
+	dip->d2_zone[NSEC_ZONE] = (zone_t) conv4(norm, (long) nsec);
+#endif
   }
 }
 
@@ -17,6 +17,8 @@
 
 #include "super.h"
 
+#define DIR_FREE_SLOTS	8	/* free directory slots remembered per inode */
+
 EXTERN struct inode {
   u16_t i_mode;		/* file type, protection, etc. */
   u16_t i_nlinks;		/* how many links to this file */
@@ -27,6 +29,8 @@ EXTERN struct inode {
   u32_t i_mtime;		/* when was file data last changed */
   u32_t i_ctime;		/* when was inode itself changed (V2 only)*/
   u32_t i_zone[V2_NR_TZONES]; /* zone numbers for direct, ind, and dbl ind */
+  u32_t i_mtime_nsec;		/* sub-second part of i_mtime, in ns */
+  u32_t i_ctime_nsec;		/* sub-second part of i_ctime, in ns */
   
   /* The following items are not present on the disk. */
   dev_t i_dev;			/* which device is the inode on */
@@ -38,12 +42,31 @@ EXTERN struct inode {
   char i_dirt;			/* CLEAN or DIRTY */
   zone_t i_zsearch;		/* where to start search for new zones */
   off_t i_last_dpos;		/* where to start dentry search */
+  ino_t i_parent;		/* what ".." of a directory refers to, or
+				 * NO_ENTRY if it has not been looked up yet */
+  off_t i_free_slot[DIR_FREE_SLOTS]; /* free directory slots left by unlink */
+  int i_nr_free;		/* number of them */
+  char i_free_all;		/* TRUE if the directory has no other free slots */
+  int i_nr_live;		/* entries of a directory other than "." and "..",
+				 * or -1 if they have not been counted */
+  unsigned int i_live_gen;	/* live_gen that i_nr_live was counted at */
+  char i_shared;		/* TRUE if it may map zones of a clone, see
+				 * zref.c; kept in a bit of NSEC_ZONE */
   
   char i_mountpoint;		/* true if mounted on */
 
   char i_seek;			/* set on LSEEK, cleared on READ/WRITE */
   char i_update;		/* the ATIME, CTIME, and MTIME bits are here */
 
+  signed char i_lmode;		/* cached mode set by X.mode files in here */
+  signed char i_lrmode;		/* cached mode set by X.rmode files in here */
+  signed char i_imode;		/* cached mode inherited from the ancestors */
+  char i_mode_dep;		/* TRUE if a subdir's i_imode relies on us */
+  unsigned int i_imode_gen;	/* mode_gen that i_imode was computed at */
+  char i_hot;			/* used again since it was read in */
+  u64_t i_dcgen;		/* name cache generation, see dcache.c */
+  u64_t i_dcload;		/* the same, given when read in */
+
   LIST_ENTRY(inode) i_hash;     /* hash list */
   TAILQ_ENTRY(inode) i_unused;  /* free and unused list */
   
@@ -52,19 +75,87 @@ EXTERN struct inode {
 /* list of unused/free inodes */ 
 EXTERN TAILQ_HEAD(unused_inodes_t, inode)  unused_inodes;
 
+/* unused inodes that were used more than once; evicted only after all of
+ * unused_inodes, and at most HOT_INODES_MAX long (see put_inode)
+ */
+EXTERN struct unused_inodes_t              unused_hot;
+EXTERN unsigned int nr_unused_hot;
+#define HOT_INODES_MAX     (NR_INODES * 3 / 4)
+
 /* inode hashtable */
 EXTERN LIST_HEAD(inodelist, inode)         hash_inodes[INODE_HASH_SIZE];
 
 EXTERN unsigned int inode_cache_hit;
 EXTERN unsigned int inode_cache_miss;
 
+/* bumped to invalidate every cached i_imode at once */
+EXTERN unsigned int mode_gen;
+
+/* bumped to invalidate every i_nr_live at once, when a name may be entered
+ * somewhere without it being counted
+ */
+EXTERN unsigned int live_gen;
+
+/* TRUE if mounted with relatime: reads only move an atime that is not past
+ * the mtime and ctime or is older than RELATIME_MAX_AGE seconds.
+ */
+EXTERN char relatime;
+#define RELATIME_MAX_AGE   (24 * 60 * 60)
+
+/* TRUE while the journal is replayed: inodes left without links are not
+ * freed by put_inode() until every record has been applied
+ */
+EXTERN char keep_orphans;
+
 
 /* Field values.  Note that CLEAN and DIRTY are defined in "const.h" */
 #define NO_SEEK            0	/* i_seek = NO_SEEK if last op was not SEEK */
 #define ISEEK              1	/* i_seek = ISEEK if last op was SEEK */
+#define NO_MODE_CACHED    -1	/* i_lmode/i_imode value if not yet known */
+
+/* V2 inodes never use the last (triple indirect) zone slot.  On disk it
+ * holds these fields, side by side so that either can be on without the
+ * other; new_icopy() moves them in and out and keeps the slot 0 in core:
+ *
+ *   bits  0-19	sub-second mtime, in microseconds	(SUBSEC_TIMES)
+ *   bits 20-29	sub-second ctime, in milliseconds	(SUBSEC_TIMES)
+ *   bit  30	i_shared, see zref.c			(ZONE_COW)
+ *   bit  31	zero
+ *
+ * With both switches off the slot is left alone, as it always was.  An
+ * fsck.mfs that does not know this layout takes a nonzero slot for a triple
+ * indirect zone and reports the inode, so neither switch can be turned on
+ * before fsck.mfs skips the slot.
+ */
+#define NSEC_ZONE	   (V2_NR_TZONES - 1)
+#define NSEC_MTIME_MASK	   0x000FFFFF
+#define NSEC_CTIME_SHIFT   20
+#define NSEC_CTIME_MASK	   0x3FF
+#define ZONES_SHARED	   ((zone_t) 1 << 30)	/* i_shared, see zref.c */
+#if SUBSEC_TIMES
+#define MTIME_NSEC_UNIT	   1000		/* ns per stored mtime unit */
+#define CTIME_NSEC_UNIT	   1000000	/* ns per stored ctime unit */
+#else
+#define MTIME_NSEC_UNIT	   1000000000	/* whole seconds only */
+#define CTIME_NSEC_UNIT	   1000000000
+#endif
 
 #define IN_MARKCLEAN(i) i->i_dirt = IN_CLEAN
-#define IN_MARKDIRTY(i) do { if(i->i_sp->s_rd_only) { printf("%s:%d: dirty inode on rofs ", __FILE__, __LINE__); util_stacktrace(); } else { i->i_dirt = IN_DIRTY; } } while(0)
+#define IN_MARKDIRTY(i) do { if(i->i_sp->s_rd_only) { printf("%s:%d: dirty inode on rofs ", __FILE__, __LINE__); util_stacktrace(); } else { i->i_dirt = IN_DIRTY; IN_MODECHANGED(i); IN_NAMESCHANGED(i); } } while(0)
+#define IN_MARKDIRTY_KEEPMODE(i) do { if(i->i_sp->s_rd_only) { printf("%s:%d: dirty inode on rofs ", __FILE__, __LINE__); util_stacktrace(); } else { i->i_dirt = IN_DIRTY; } } while(0)
+
+/* A mode file may have appeared in or vanished from a directory.  Drop the
+ * cached local modes and, if some subdirectory inherited from here, every
+ * cached inherited mode too.  IN_MARKDIRTY() does this because search_dir()
+ * does not say which name it entered or deleted; the link.c entry functions
+ * know the name and use IN_MARKDIRTY_KEEPMODE() unless it is a mode file.
+ */
+#define IN_MODECHANGED(i) do { i->i_lmode = NO_MODE_CACHED; if(i->i_mode_dep) { i->i_mode_dep = FALSE; mode_gen++; } } while(0)
+
+/* For the same reason, a name may have appeared in the directory: the name
+ * cache's negative entries for it are stale (see dcache.c).
+ */
+#define IN_NAMESCHANGED(i) (i->i_dcgen = 0)
 
 #define IN_ISCLEAN(i) i->i_dirt == IN_CLEAN
 #define IN_ISDIRTY(i) i->i_dirt == IN_DIRTY
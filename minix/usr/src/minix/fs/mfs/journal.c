@@ -0,0 +1,712 @@
+/* This file keeps the metadata journal.
+ *
+ * The log is the file JR_NAME in the root directory, which must have all of
+ * its blocks allocated.  Its blocks are written directly, not through the
+ * inode.  Block 0 holds the number of block 1; the log fills blocks 1, 2 and
+ * on with records, and when a transaction would not fit in what is left the
+ * journal is checkpointed before it starts: every dirty inode and block is
+ * written out and the log starts over at block 1.  jr_begin() says how many
+ * records a transaction of the request may take, and the log must hold the
+ * largest one, so a transaction never straddles a checkpoint.
+ *
+ * A record says that a name in a directory went from one inode to another
+ * (NO_ENTRY if it was not there, or is not any more), that a link count went
+ * from one value to another, or that a request was done with its changes,
+ * which ends a transaction.  A directory record is on disk before the block
+ * it is about is changed in the cache, so before that block can get to disk.
+ * A link count record only has to be on disk before the inode is written
+ * back (see rw_inode), and mostly goes out with the next directory record.
+ * The end of the last transaction of a request is on disk before the reply:
+ * a request that was answered is never undone.  rmtree and copytree end a
+ * transaction after each entry with jr_mark(); those ends go out with the
+ * next write, so a crash undoes the request back to an entry boundary.
+ *
+ * At mount every transaction that has its end on disk is done again, and the
+ * records after the last end are undone, last first.  Either way a record
+ * only changes what still has the value it started from (or, undoing, ended
+ * at): a change that did get to disk, or that a request not in the journal
+ * made since, is left as it is.  Inodes left without links are freed when
+ * all records have been replayed.
+ *
+ * The journal is replayed by jr_open() when the file system is mounted,
+ * before any request is served, and closed by jr_close() when it is
+ * unmounted.
+ *
+ * Only link.c logs.  creat, mkdir, mknod and symlink enter names and change
+ * link counts without logging, so no record may be replayed over what they
+ * did.  The inode numbers the records since the last checkpoint are about
+ * are kept in a small hashed set; alloc_inode() passes over those while it
+ * can (jr_reused) and the file it makes is new to the log.  Only if it
+ * cannot, or if a directory is made while link counts of directories have
+ * been logged (mkdir raises that of its parent), is the journal
+ * checkpointed first (jr_alloc).  A transaction is ended before an inode
+ * without links is freed, since that cannot be undone; the rest of the
+ * request goes in a new one.
+ *
+ * Directory compaction moves entries without logging them, so it is refused
+ * while the journal is on (see jr_enabled).
+ *
+ * The entry points into this file are
+ *   jr_init:   forget the journal of the previous mount
+ *   jr_open:   find the journal and replay it, at mount
+ *   jr_close:  write everything out and stop logging, at unmount
+ *   jr_enabled: tell whether changes are being logged
+ *   jr_begin:  a request that logs its changes starts making them
+ *   jr_mark:   what it did so far may stay, whatever comes after
+ *   jr_end:    it is done making them; get that to disk
+ *   jr_dirent: log a change of a directory entry, before it is made
+ *   jr_nlink:  log a change of a link count, before it is made
+ *   jr_write:  get what was logged to disk
+ *   jr_cancel: take back the last record, for a change that failed
+ *   jr_commit: end the transaction now and get it to disk
+ *   jr_reused: tell whether an inode number had better not be given out
+ *   jr_alloc:  an inode is about to be allocated
+ *   jr_forget: blocks of an inode are about to be freed
+ */
+
+#include "fs.h"
+#include <string.h>
+#include "buf.h"
+#include "inode.h"
+#include "super.h"
+#include "dcache.h"
+#include "journal.h"
+#include <minix/mfsif.h>
+
+#define JR_MAGIC	0x4D464A31	/* "MFJ1" */
+#define JR_MIN_BLOCKS	2	/* block 0 and room for records */
+#define JR_MAX_BLOCKS	1024	/* blocks of the file used at most */
+#define JR_ROOM_MAX	(MFS_LINK_BATCH_MAX + 2)	/* the largest
+					 * transaction, a link batch, and its end */
+#define JR_SEEN		4096	/* bits in the set of inodes in the log */
+
+#define JR_DIRENT	1	/* a name in directory jr_ino */
+#define JR_NLINK	2	/* the link count of inode jr_ino */
+#define JR_END		3	/* the end of a transaction */
+
+struct jr_head {
+  u32_t jh_magic;		/* JR_MAGIC */
+  u32_t jh_seq;			/* number of the block since the log was
+				 * made; in block 0, that of block 1 */
+  u32_t jh_count;		/* records that follow */
+  u32_t jh_sum;			/* jr_sum() of the head and the records */
+};
+
+struct jr_rec {
+  u32_t jr_type;		/* JR_DIRENT, JR_NLINK or JR_END */
+  u32_t jr_ino;			/* the directory, or the inode */
+  u32_t jr_old;			/* inode the name referred to, or link */
+  u32_t jr_new;			/*   count, before and after */
+  char jr_name[MFS_NAME_MAX];	/* the name, NUL padded */
+};
+
+#define JR_HEAD		((struct jr_head *) jr_buf)
+#define JR_REC(i)	((struct jr_rec *) (JR_HEAD + 1) + (i))
+
+static enum { JR_CLOSED, JR_OFF, JR_REPLAY, JR_ON } jr_state = JR_CLOSED;
+
+static dev_t jr_dev;		/* device the journal is on */
+static struct super_block *jr_sp;	/* and its super block */
+static ino_t jr_ino;		/* the journal file */
+static block_t jr_blocks[JR_MAX_BLOCKS];	/* its blocks */
+static int jr_nblocks;		/* how many of them are used */
+static int jr_max;		/* records per block */
+static u32_t jr_seq;		/* number of the next block */
+static int jr_cur;		/* block in jr_buf, 0 if none */
+static int jr_unwritten;	/* TRUE if jr_buf is ahead of the disk */
+static int jr_open_tx;		/* TRUE if records follow the last end */
+static int jr_in_req;		/* TRUE between jr_begin() and jr_end() */
+static int jr_room;		/* records, end included, a transaction of
+				 * the request takes at most */
+static int jr_tx_count;		/* records in the open transaction */
+static int jr_dir_links;	/* TRUE if link counts of directories are
+				 * in the log */
+static u8_t jr_seen[JR_SEEN / 8];	/* inode numbers in the log, hashed */
+static u32_t jr_buf[_MAX_BLOCK_SIZE / sizeof(u32_t)];	/* block jr_cur */
+
+static u32_t jr_sum(void);
+static void jr_io(int b, int rw_flag);
+static int jr_valid(int b, u32_t seq);
+static void jr_next(void);
+static int jr_free_records(void);
+static void jr_see(ino_t ino);
+static struct jr_rec *jr_append(u32_t type, ino_t ino);
+static void jr_close_tx(void);
+static void jr_checkpoint(void);
+static void jr_replay(void);
+static void jr_set(struct jr_rec *rec, u32_t from, u32_t to);
+static void jr_release(struct jr_rec *rec);
+static struct inode *jr_get(ino_t ino);
+static int jr_allocated(ino_t ino);
+
+/*===========================================================================*
+ *				jr_init					     *
+ *===========================================================================*/
+void jr_init(void)
+{
+  jr_state = JR_CLOSED;
+}
+
+/*===========================================================================*
+ *				jr_open					     *
+ *===========================================================================*/
+void jr_open(dev_t dev)
+{
+/* Look for the journal and replay it.  fs_readsuper() calls this, before
+ * any request can see what a crash left behind.
+ */
+  struct inode *root, *ip;
+  ino_t numb;
+  int b, block_size, r;
+
+  if (jr_state != JR_CLOSED) return;
+  jr_state = JR_OFF;
+
+  if ((root = get_inode(dev, ROOT_INODE)) == NULL) return;
+  r = (root->i_sp->s_rd_only ? EROFS : dc_search(root, JR_NAME, &numb));
+  put_inode(root);
+  if (r != OK || (ip = get_inode(dev, numb)) == NULL) return;
+
+  /* Only blocks that are there can be written directly. */
+  block_size = ip->i_sp->s_block_size;
+  jr_max = (block_size - sizeof(struct jr_head)) / sizeof(struct jr_rec);
+  jr_nblocks = min(ip->i_size / block_size, JR_MAX_BLOCKS);
+  for (b = 0; b < jr_nblocks; b++) {
+	jr_blocks[b] = read_map(ip, (off_t) b * block_size, 0);
+	if (jr_blocks[b] == NO_BLOCK) break;
+  }
+  if ((ip->i_mode & I_TYPE) != I_REGULAR || ip->i_shared ||
+      jr_nblocks < JR_MIN_BLOCKS || b < jr_nblocks ||
+      (jr_nblocks - 1) * jr_max < JR_ROOM_MAX) {
+	printf("MFS: /%s has holes or is too small for a journal\n", JR_NAME);
+	put_inode(ip);
+	return;
+  }
+
+  /* It is not kept in use, which would keep the device busy; freeing its
+   * blocks turns the journal off (see jr_forget).
+   */
+  jr_dev = dev;
+  jr_sp = ip->i_sp;
+  jr_ino = ip->i_num;
+  put_inode(ip);
+
+  jr_cur = 0;
+  jr_unwritten = jr_open_tx = jr_in_req = FALSE;
+  jr_room = JR_TX_MAX + 1;
+
+  jr_state = JR_REPLAY;
+  jr_replay();
+  jr_checkpoint();
+  jr_state = JR_ON;
+}
+
+/*===========================================================================*
+ *				jr_close				     *
+ *===========================================================================*/
+void jr_close(void)
+{
+/* The file system is being unmounted.  Get everything to disk, so that
+ * nothing is left to replay, and log nothing more.  fs_unmount() calls this.
+ */
+  if (jr_state == JR_ON) {
+	jr_commit();
+	jr_checkpoint();
+  }
+  jr_state = JR_CLOSED;
+}
+
+/*===========================================================================*
+ *				jr_enabled				     *
+ *===========================================================================*/
+int jr_enabled(void)
+{
+  return(jr_state == JR_ON);
+}
+
+/*===========================================================================*
+ *				jr_begin				     *
+ *===========================================================================*/
+void jr_begin(
+  int nrec			/* records one transaction logs at most */
+)
+{
+/* A request starts making changes that it logs.  Each of its transactions
+ * gets room for 'nrec' records and its end before its first record.
+ */
+  jr_in_req = TRUE;
+  jr_room = nrec + 1;
+}
+
+/*===========================================================================*
+ *				jr_mark					     *
+ *===========================================================================*/
+void jr_mark(void)
+{
+/* What the request did so far leaves the file system as it should be: end
+ * the transaction here, so that a crash undoes no more than what follows.
+ * The end goes to disk with the next write.
+ */
+  jr_close_tx();
+}
+
+/*===========================================================================*
+ *				jr_end					     *
+ *===========================================================================*/
+void jr_end(void)
+{
+/* The request is done with its changes.  The end is on disk before the
+ * reply goes out, so that replay never undoes a request that was answered.
+ */
+  jr_close_tx();
+  jr_write();
+  jr_in_req = FALSE;
+  jr_room = JR_TX_MAX + 1;
+}
+
+/*===========================================================================*
+ *				jr_dirent				     *
+ *===========================================================================*/
+void jr_dirent(
+  struct inode *dirp,		/* directory about to be changed */
+  const char *name,		/* name in it */
+  ino_t old,			/* inode it refers to, or NO_ENTRY */
+  ino_t new			/* inode it is to refer to, or NO_ENTRY */
+)
+{
+/* Log a change of a directory entry.  The caller calls jr_write() before it
+ * changes the block.
+ */
+  struct jr_rec *rec;
+
+  if ((rec = jr_append(JR_DIRENT, dirp->i_num)) == NULL) return;
+  rec->jr_old = (u32_t) old;
+  rec->jr_new = (u32_t) new;
+  jr_see(old);
+  jr_see(new);
+  strncpy(rec->jr_name, name, MFS_NAME_MAX);
+}
+
+/*===========================================================================*
+ *				jr_nlink				     *
+ *===========================================================================*/
+void jr_nlink(
+  struct inode *rip,		/* inode whose link count is to change */
+  int nlinks			/* what it is to become */
+)
+{
+  struct jr_rec *rec;
+
+  if ((rec = jr_append(JR_NLINK, rip->i_num)) == NULL) return;
+  rec->jr_old = (u32_t) rip->i_nlinks;
+  rec->jr_new = (u32_t) nlinks;
+  if ((rip->i_mode & I_TYPE) == I_DIRECTORY) jr_dir_links = TRUE;
+}
+
+/*===========================================================================*
+ *				jr_write				     *
+ *===========================================================================*/
+void jr_write(void)
+{
+/* Write the block being filled, if the disk is behind, and wait for it. */
+  if (jr_state != JR_ON || jr_cur == 0 || !jr_unwritten) return;
+
+  JR_HEAD->jh_sum = jr_sum();
+  jr_io(jr_cur, WRITING);
+  jr_unwritten = FALSE;
+}
+
+/*===========================================================================*
+ *				jr_cancel				     *
+ *===========================================================================*/
+void jr_cancel(void)
+{
+/* The change logged last was not made after all; take its record back, so
+ * that it is not made at replay either.  The record is in the block being
+ * filled, since nothing was logged after it.
+ */
+  if (jr_state != JR_ON || jr_cur == 0 || JR_HEAD->jh_count == 0) return;
+  if (JR_REC(JR_HEAD->jh_count - 1)->jr_type == JR_END) return;
+  JR_HEAD->jh_count--;
+  jr_tx_count--;
+  jr_unwritten = TRUE;
+  jr_write();
+}
+
+/*===========================================================================*
+ *				jr_commit				     *
+ *===========================================================================*/
+void jr_commit(void)
+{
+/* End the transaction here and get it to disk: what follows cannot be
+ * undone.
+ */
+  jr_close_tx();
+  jr_write();
+}
+
+/*===========================================================================*
+ *				jr_reused				     *
+ *===========================================================================*/
+int jr_reused(ino_t ino)
+{
+/* May records in the log be about an earlier file with number 'ino'? */
+  int h;
+
+  if (jr_state != JR_ON) return(FALSE);
+  h = (int) (ino % JR_SEEN);
+  return((jr_seen[h / 8] >> (h % 8)) & 1);
+}
+
+/*===========================================================================*
+ *				jr_alloc				     *
+ *===========================================================================*/
+void jr_alloc(
+  ino_t ino,			/* inode about to be given out */
+  mode_t bits			/* and its mode */
+)
+{
+/* Outside link.c the name and links the new inode gets are not logged, so
+ * no record may be replayed over them: none about an earlier file with its
+ * number, and for a directory none about the link count of its parent,
+ * which mkdir raises.  Checkpoint if that cannot be ruled out.
+ */
+  if (jr_state != JR_ON || jr_in_req) return;
+  if (jr_reused(ino) || ((bits & I_TYPE) == I_DIRECTORY && jr_dir_links))
+	jr_checkpoint();
+}
+
+/*===========================================================================*
+ *				jr_forget				     *
+ *===========================================================================*/
+void jr_forget(struct inode *rip)
+{
+/* Blocks of 'rip' are about to be freed.  If it is the journal, everything
+ * is written out and nothing is logged any more until the next mount.
+ */
+  if (jr_state != JR_ON || rip->i_dev != jr_dev || rip->i_num != jr_ino)
+	return;
+  jr_commit();
+  jr_checkpoint();
+  jr_state = JR_OFF;
+  printf("MFS: /%s is being freed, journal off\n", JR_NAME);
+}
+
+/*===========================================================================*
+ *				jr_sum					     *
+ *===========================================================================*/
+static u32_t jr_sum(void)
+{
+  u32_t sum, saved, *p, *end;
+
+  saved = JR_HEAD->jh_sum;
+  JR_HEAD->jh_sum = 0;
+  end = (u32_t *) JR_REC(JR_HEAD->jh_count);
+  for (sum = 0, p = jr_buf; p < end; p++)
+	sum = ((sum << 1) | (sum >> 31)) ^ *p;
+  JR_HEAD->jh_sum = saved;
+  return(sum);
+}
+
+/*===========================================================================*
+ *				jr_io					     *
+ *===========================================================================*/
+static void jr_io(
+  int b,			/* block of the journal */
+  int rw_flag			/* READING or WRITING */
+)
+{
+/* Read block 'b' of the journal into jr_buf, or write it from there and
+ * wait until it is on disk.
+ */
+  struct buf *bp;
+  size_t block_size;
+
+  block_size = jr_sp->s_block_size;
+  if (rw_flag == READING) {
+	bp = get_block(jr_dev, jr_blocks[b], NORMAL);
+	memcpy(jr_buf, b_data(bp), block_size);
+	put_block(bp, FULL_DATA_BLOCK);
+	return;
+  }
+
+  bp = get_block(jr_dev, jr_blocks[b], NO_READ);
+  memcpy(b_data(bp), jr_buf, block_size);
+  MARKDIRTY(bp);
+  lmfs_rw_scattered(jr_dev, &bp, 1, WRITING);
+  put_block(bp, FULL_DATA_BLOCK);
+}
+
+/*===========================================================================*
+ *				jr_valid				     *
+ *===========================================================================*/
+static int jr_valid(int b, u32_t seq)
+{
+/* Read block 'b' of the journal and tell whether it is block 'seq' in full. */
+  jr_io(b, READING);
+  return(JR_HEAD->jh_magic == JR_MAGIC && JR_HEAD->jh_seq == seq &&
+	JR_HEAD->jh_count <= jr_max && JR_HEAD->jh_sum == jr_sum());
+}
+
+/*===========================================================================*
+ *				jr_next					     *
+ *===========================================================================*/
+static void jr_next(void)
+{
+/* Write out the block being filled and start the next one.  There is one:
+ * jr_append() made room for the whole transaction before it started.
+ */
+  jr_write();
+  if (jr_cur + 1 >= jr_nblocks) panic("MFS: journal full");
+
+  jr_cur++;
+  memset(jr_buf, 0, sizeof(struct jr_head));
+  JR_HEAD->jh_magic = JR_MAGIC;
+  JR_HEAD->jh_seq = jr_seq++;
+  jr_unwritten = TRUE;
+}
+
+/*===========================================================================*
+ *				jr_append				     *
+ *===========================================================================*/
+static struct jr_rec *jr_append(
+  u32_t type,			/* JR_DIRENT, JR_NLINK or JR_END */
+  ino_t ino			/* the directory or inode it is about */
+)
+{
+  struct jr_rec *rec;
+
+  if (jr_state != JR_ON) return(NULL);
+
+  /* A transaction never goes on past a checkpoint, which would leave its
+   * start without a way back: if the rest of the log cannot take all of
+   * it, checkpoint before it starts.
+   */
+  if (!jr_open_tx) {
+	if (jr_free_records() < jr_room) jr_checkpoint();
+	jr_tx_count = 0;
+  }
+  if (++jr_tx_count > jr_room)
+	panic("MFS: journal transaction over %d records", jr_room);
+  if (jr_cur == 0 || JR_HEAD->jh_count == jr_max) jr_next();
+
+  rec = JR_REC(JR_HEAD->jh_count++);
+  memset(rec, 0, sizeof(*rec));
+  rec->jr_type = type;
+  rec->jr_ino = (u32_t) ino;
+  jr_open_tx = (type != JR_END);
+  jr_unwritten = TRUE;
+  if (type != JR_END) jr_see(ino);
+  return(rec);
+}
+
+/*===========================================================================*
+ *				jr_free_records				     *
+ *===========================================================================*/
+static int jr_free_records(void)
+{
+/* How many more records the log takes before it has to start over? */
+  if (jr_cur == 0) return((jr_nblocks - 1) * jr_max);
+  return(jr_max - (int) JR_HEAD->jh_count +
+	(jr_nblocks - 1 - jr_cur) * jr_max);
+}
+
+/*===========================================================================*
+ *				jr_see					     *
+ *===========================================================================*/
+static void jr_see(ino_t ino)
+{
+/* A record is about inode 'ino': add it to the set jr_reused() looks in. */
+  int h;
+
+  if (ino == NO_ENTRY) return;
+  h = (int) (ino % JR_SEEN);
+  jr_seen[h / 8] |= 1 << (h % 8);
+}
+
+/*===========================================================================*
+ *				jr_close_tx				     *
+ *===========================================================================*/
+static void jr_close_tx(void)
+{
+  if (jr_open_tx) (void) jr_append(JR_END, NO_ENTRY);
+}
+
+/*===========================================================================*
+ *				jr_checkpoint				     *
+ *===========================================================================*/
+static void jr_checkpoint(void)
+{
+/* Get every change made so far to disk, so that no record is needed any
+ * more, and start the log over.  Only done between transactions.
+ */
+  struct inode *rip;
+
+  jr_write();
+  for (rip = &inode[0]; rip < &inode[NR_INODES]; rip++)
+	if (rip->i_count > 0 && IN_ISDIRTY(rip)) rw_inode(rip, WRITING);
+  lmfs_flushall();
+
+  memset(jr_buf, 0, jr_sp->s_block_size);
+  JR_HEAD->jh_magic = JR_MAGIC;
+  JR_HEAD->jh_seq = jr_seq;
+  jr_io(0, WRITING);
+  jr_cur = 0;
+  jr_unwritten = FALSE;
+  memset(jr_seen, 0, sizeof(jr_seen));
+  jr_dir_links = FALSE;
+}
+
+/*===========================================================================*
+ *				jr_replay				     *
+ *===========================================================================*/
+static void jr_replay(void)
+{
+/* Redo the transactions logged since the last checkpoint and undo what
+ * follows the last end, then free the inodes left without links.
+ */
+  struct jr_rec *rec;
+  u32_t base;
+  int b, i, n, end_b, end_i, tx;
+
+  jr_io(0, READING);
+  if (JR_HEAD->jh_magic != JR_MAGIC) {
+	jr_seq = 1;			/* never used */
+	return;
+  }
+  base = JR_HEAD->jh_seq;
+
+  /* Find the blocks written since, and the last end in them. */
+  end_b = end_i = 0;
+  tx = 0;
+  for (n = 0; n + 1 < jr_nblocks && jr_valid(n + 1, base + n); n++) {
+	for (i = 0; i < JR_HEAD->jh_count; i++) {
+		if (JR_REC(i)->jr_type != JR_END) continue;
+		end_b = n + 1;
+		end_i = i;
+		tx++;
+	}
+  }
+  jr_seq = base + n;
+  if (n == 0) return;
+
+  /* Inodes may go through no links on the way, so none is freed yet. */
+  keep_orphans = TRUE;
+  for (b = 1; b <= end_b; b++) {
+	(void) jr_valid(b, base + b - 1);
+	for (i = 0; i < JR_HEAD->jh_count && (b < end_b || i < end_i); i++) {
+		rec = JR_REC(i);
+		jr_set(rec, rec->jr_old, rec->jr_new);
+	}
+  }
+  for (b = n; b >= 1 && b >= end_b; b--) {
+	(void) jr_valid(b, base + b - 1);
+	for (i = JR_HEAD->jh_count - 1; i >= 0 && (b > end_b || i > end_i);
+	     i--) {
+		rec = JR_REC(i);
+		jr_set(rec, rec->jr_new, rec->jr_old);
+	}
+  }
+  keep_orphans = FALSE;
+
+  for (b = 1; b <= n; b++) {
+	(void) jr_valid(b, base + b - 1);
+	for (i = 0; i < JR_HEAD->jh_count; i++)
+		jr_release(JR_REC(i));
+  }
+
+  printf("MFS: journal replayed, %d transaction%s\n", tx, tx == 1 ? "" : "s");
+}
+
+/*===========================================================================*
+ *				jr_set					     *
+ *===========================================================================*/
+static void jr_set(
+  struct jr_rec *rec,		/* what to change */
+  u32_t from,			/* the value it has to have now */
+  u32_t to			/* the value to give it */
+)
+{
+  struct inode *rip, *dirp;
+  char name[MFS_NAME_MAX + 1];
+  int live;
+
+  if (rec->jr_type == JR_NLINK) {
+	if ((rip = jr_get(rec->jr_ino)) == NULL) return;
+	if (rip->i_nlinks == from && rip->i_mode != I_NOT_ALLOC) {
+		rip->i_nlinks = to;
+		IN_MARKDIRTY(rip);
+	}
+	put_inode(rip);
+	return;
+  }
+  if (rec->jr_type != JR_DIRENT) return;
+
+  /* A name is only made to refer to a file that is there. */
+  if (to != NO_ENTRY) {
+	if ((rip = jr_get(to)) == NULL) return;
+	live = (rip->i_mode != I_NOT_ALLOC);
+	put_inode(rip);
+	if (!live) return;
+  }
+
+  if ((dirp = jr_get(rec->jr_ino)) == NULL) return;
+  if ((dirp->i_mode & I_TYPE) == I_DIRECTORY && dirp->i_nlinks != NO_LINK) {
+	memcpy(name, rec->jr_name, MFS_NAME_MAX);
+	name[MFS_NAME_MAX] = '\0';
+	(void) replay_dirent(dirp, name, (ino_t) from, (ino_t) to);
+  }
+  put_inode(dirp);
+}
+
+/*===========================================================================*
+ *				jr_release				     *
+ *===========================================================================*/
+static void jr_release(struct jr_rec *rec)
+{
+/* Let go of the inodes 'rec' is about; put_inode() frees those that have
+ * no links.
+ */
+  if (rec->jr_type == JR_END) return;
+  put_inode(jr_get(rec->jr_ino));
+  if (rec->jr_type != JR_DIRENT) return;
+  put_inode(jr_get(rec->jr_old));
+  put_inode(jr_get(rec->jr_new));
+}
+
+/*===========================================================================*
+ *				jr_get					     *
+ *===========================================================================*/
+static struct inode *jr_get(ino_t ino)
+{
+/* Get inode 'ino' if it is allocated.  A free one is never got: putting it
+ * back would free it again.
+ */
+  if (!jr_allocated(ino)) return(NULL);
+  return(get_inode(jr_dev, ino));
+}
+
+/*===========================================================================*
+ *				jr_allocated				     *
+ *===========================================================================*/
+static int jr_allocated(ino_t ino)
+{
+/* Is the bit of inode 'ino' set in the inode map? */
+  struct super_block *sp;
+  struct buf *bp;
+  bitchunk_t k;
+  bit_t bit;
+  block_t b;
+  int word;
+
+  sp = jr_sp;
+  if (ino == NO_ENTRY || ino > sp->s_ninodes) return(FALSE);
+
+  bit = (bit_t) ino;
+  b = START_BLOCK + bit / FS_BITS_PER_BLOCK(sp->s_block_size);
+  word = (bit % FS_BITS_PER_BLOCK(sp->s_block_size)) / FS_BITCHUNK_BITS;
+  bp = get_block(sp->s_dev, b, NORMAL);
+  k = (bitchunk_t) conv4(sp->s_native, (int) b_bitmap(bp)[word]);
+  put_block(bp, MAP_BLOCK);
+  return((k >> (bit % FS_BITCHUNK_BITS)) & 1);
+}
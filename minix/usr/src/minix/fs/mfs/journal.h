@@ -0,0 +1,42 @@
+#ifndef __MFS_JOURNAL_H__
+#define __MFS_JOURNAL_H__
+
+/* Metadata journal: the directory entries entered and deleted and the link
+ * counts changed by link, unlink, rmdir, rename and the other requests in
+ * link.c are logged, as one transaction per request, in the preallocated file
+ * JR_NAME in the root directory before they are made.  At mount the log is
+ * replayed, so that every request is either done in full or not at all.
+ * Without that file nothing is logged.  See journal.c.
+ *
+ * fs_readsuper() calls jr_open() once the super block is read, and
+ * fs_unmount() calls jr_close() before the device is let go.
+ */
+
+#define JR_NAME		".journal"	/* the log, in the root directory */
+#define JR_TX_MAX	32	/* records one transaction of a request logs
+				 * at most, unless jr_begin() is told more */
+#define JR_SKIP_MAX	8	/* inode numbers alloc_inode() passes over */
+
+struct inode;
+
+void jr_init(void);
+void jr_open(dev_t dev);
+void jr_close(void);
+int jr_enabled(void);
+void jr_begin(int nrec);
+void jr_mark(void);
+void jr_end(void);
+void jr_dirent(struct inode *dirp, const char *name, ino_t old, ino_t new);
+void jr_nlink(struct inode *rip, int nlinks);
+void jr_write(void);
+void jr_cancel(void);
+void jr_commit(void);
+int jr_reused(ino_t ino);
+void jr_alloc(ino_t ino, mode_t bits);
+void jr_forget(struct inode *rip);
+
+/* link.c */
+int replay_dirent(struct inode *dirp, char name[MFS_NAME_MAX], ino_t from,
+	ino_t to);
+
+#endif
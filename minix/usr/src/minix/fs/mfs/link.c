@@ -5,14 +5,56 @@
 #include "buf.h"
 #include "inode.h"
 #include "super.h"
+#include "reqstats.h"
+#include "trace.h"
+#include "dcache.h"
+#include "zref.h"
+#include "journal.h"
 #include <minix/vfsif.h>
+#include <minix/mfsif.h>
 #include <sys/param.h>
 #include <stdbool.h>
+#include <assert.h>
 
 #define SAME 1000
 
+/* Directory trees deeper than this are taken for a file system loop. */
+#define MAX_DIR_DEPTH 1024
+
 static int freesp_inode(struct inode *rip, off_t st, off_t end);
+static int enter_batch(struct inode *dirp, int idx[], int count, ino_t numb);
+static struct inode *get_parent(struct inode *dirp);
+static int check_superdir(struct inode *dirp, struct inode *rip);
+static int rewrite_dir_entry(struct inode *dirp, char name[MFS_NAME_MAX],
+                             char *new_name, ino_t numb);
+static int dir_enter(struct inode *dirp, char name[MFS_NAME_MAX], ino_t numb);
+static int dir_delete(struct inode *dirp, char name[MFS_NAME_MAX]);
+static void dir_trim(struct inode *dirp);
+static void count_entry(struct inode *dirp, const char *name, int n);
+static void dir_changed(struct inode *dirp, const char *name);
+static bool checkFileName(const char *const file_name);
+static int dir_is_empty(struct inode *dirp);
+static int dir_compact(struct inode *dirp);
+static int exchange_entries(struct inode *old_dirp, struct inode *old_ip,
+                            char old_name[MFS_NAME_MAX], struct inode *new_dirp,
+                            struct inode *new_ip, char new_name[MFS_NAME_MAX]);
 static int remove_dir(struct inode *rldirp, struct inode *rip, char dir_name[MFS_NAME_MAX]);
+static int rmtree(struct inode *dirp, struct inode *rip, char name[MFS_NAME_MAX],
+                  struct mfs_rmtree *rt);
+static void rmtree_file(struct inode *dirp, struct inode *rip,
+                        char name[MFS_NAME_MAX], struct mfs_rmtree *rt, int *left);
+static void rmtree_fail(struct mfs_rmtree *rt, int r, ino_t numb);
+static int next_entry(struct inode *dirp, off_t *pos,
+                      char name[MFS_NAME_MAX + 1], ino_t *numb);
+static bool checkWhetherBak(const char *const str);
+static void copytree(struct inode *src, struct inode *dst,
+                     struct mfs_copytree *ct);
+static struct inode *copy_node(struct inode *src, struct inode *dst_dirp,
+                               char name[MFS_NAME_MAX],
+                               struct mfs_copytree *ct);
+static int copy_data(struct inode *src, struct inode *dst,
+                     struct mfs_copytree *ct);
+static void copytree_fail(struct mfs_copytree *ct, int r, ino_t numb);
 static int unlink_file(struct inode *dirp, struct inode *rip, char file_name[MFS_NAME_MAX]);
 static off_t nextblock(off_t pos, int zone_size);
 static void zerozone_half(struct inode *rip, off_t pos, int half, int zone_size);
@@ -22,6 +64,43 @@ static void zerozone_range(struct inode *rip, off_t pos, off_t len);
 #define FIRST_HALF 0
 #define LAST_HALF 1
 
+/* Targets of the REQ_LINK_BATCH request being handled. */
+static struct mfs_link_target link_batch[MFS_LINK_BATCH_MAX];
+
+/* Directories being emptied by the REQ_RMTREE request being handled, one per
+ * level of the tree.
+ */
+static struct rmtree_frame
+{
+  struct inode *rf_dir;           /* the directory */
+  off_t rf_pos;                   /* where its next entry is looked for */
+  char rf_name[MFS_NAME_MAX + 1]; /* its name in the directory one up */
+  int rf_left;                    /* entries that are staying in it */
+} rmtree_stack[MAX_DIR_DEPTH];
+
+/* Files the deletion modes of mode C directories renamed to .bak during the
+ * REQ_RMTREE walk, so that the walk does not find and remove them again.
+ * Once the table is full, the walk stops removing with ENOSPC.
+ */
+#define RMTREE_KEPT (MFS_RMTREE_KEPT_MAX + 1) /* a power of two */
+static ino_t rmtree_kept[RMTREE_KEPT];
+static int rmtree_nr_kept;
+
+/* Directories being copied by the REQ_COPYTREE request being handled, one
+ * per level of the tree.
+ */
+static struct copytree_frame
+{
+  struct inode *cf_src; /* the directory being copied */
+  struct inode *cf_dst; /* its copy */
+  off_t cf_pos;         /* where its next entry is looked for */
+} copytree_stack[MAX_DIR_DEPTH];
+
+/* Where the copy of the next file starts looking for free zones, so that the
+ * copies are laid out one after the other.
+ */
+static zone_t copytree_zsearch;
+
 /*===========================================================================*
  *				fs_link 				     *
  *===========================================================================*/
@@ -79,7 +158,7 @@ int fs_link()
   }
 
   /* If 'name2' exists in full (even if no space) set 'r' to error. */
-  if ((new_ip = advance(ip, string, IGN_PERM)) == NULL)
+  if ((new_ip = dc_advance(ip, string)) == NULL)
   {
     r = err_code;
     if (r == ENOENT)
@@ -92,16 +171,25 @@ int fs_link()
   }
 
   /* Try to link. */
+  jr_begin(JR_TX_MAX);
   if (r == OK)
-    r = search_dir(ip, string, &rip->i_num, ENTER, IGN_PERM);
+  {
+    r = dir_enter(ip, string, rip->i_num);
+    if (r == OK)
+      dc_entered(ip, string, rip->i_num);
+  }
 
   /* If success, register the linking. */
   if (r == OK)
   {
+    jr_nlink(rip, rip->i_nlinks + 1);
     rip->i_nlinks++;
     rip->i_update |= CTIME;
     IN_MARKDIRTY(rip);
+    if (strcmp(string, dot2) == 0)
+      ip->i_parent = NO_ENTRY;
   }
+  jr_end();
 
   /* Done.  Release both inodes. */
   put_inode(rip);
@@ -109,6 +197,262 @@ int fs_link()
   return (r);
 }
 
+/*===========================================================================*
+ *				fs_link_batch				     *
+ *===========================================================================*/
+int fs_link_batch()
+{
+  /* Link one inode under many (directory, name) pairs. The inode is fetched
+   * and checked once, its link count is raised once for all new links, and
+   * the targets in one directory are entered in a single directory pass.
+   * Every target gets its own status; the request only fails as a whole if
+   * the targets cannot be copied or the links would not all fit.
+   */
+  struct inode *rip, *dirp;
+  int idx[MFS_LINK_BATCH_MAX];
+  int i, j, n, count, linked, r;
+  phys_bytes len;
+
+  len = fs_m_in.m_vfs_fs_link.path_len;
+  n = len / sizeof(link_batch[0]);
+  if (n <= 0 || n > MFS_LINK_BATCH_MAX || len % sizeof(link_batch[0]) != 0)
+    return (EINVAL);
+
+  r = sys_safecopyfrom(VFS_PROC_NR, fs_m_in.m_vfs_fs_link.grant,
+                       (vir_bytes)0, (vir_bytes)link_batch, (size_t)len);
+  if (r != OK)
+    return r;
+
+  /* Temporarily open the file. */
+  if ((rip = get_inode(fs_dev, fs_m_in.m_vfs_fs_link.inode)) == NULL)
+    return (EINVAL);
+
+  /* Check to see if the file has room for all the links. */
+  r = OK;
+  if (rip->i_nlinks + n > LINK_MAX)
+    r = EMLINK;
+
+  /* Only super_user may link to directories. */
+  if (r == OK)
+    if ((rip->i_mode & I_TYPE) == I_DIRECTORY && caller_uid != SU_UID)
+      r = EPERM;
+
+  if (r != OK)
+  {
+    put_inode(rip);
+    return (r);
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    link_batch[i].lt_name[MFSIF_NAME_MAX - 1] = '\0';
+    link_batch[i].lt_status = EINPROGRESS; /* not handled yet */
+  }
+
+  linked = 0;
+  jr_begin(n + 1);
+  for (i = 0; i < n; i++)
+  {
+    if (link_batch[i].lt_status != EINPROGRESS)
+      continue;
+
+    /* Gather all targets in this directory. */
+    count = 0;
+    for (j = i; j < n; j++)
+    {
+      if (link_batch[j].lt_status == EINPROGRESS &&
+          link_batch[j].lt_dir == link_batch[i].lt_dir)
+      {
+        link_batch[j].lt_status = OK;
+        idx[count++] = j;
+      }
+    }
+
+    /* Temporarily open the dir, if the caller's number can be one. */
+    dirp = NULL;
+    if (link_batch[i].lt_dir < ROOT_INODE ||
+        link_batch[i].lt_dir > rip->i_sp->s_ninodes)
+      r = EINVAL;
+    else if ((dirp = get_inode(fs_dev, link_batch[i].lt_dir)) == NULL)
+      r = EINVAL;
+    else if (dirp->i_nlinks == NO_LINK)
+      r = ENOENT; /* Dir does not actually exist */
+    else
+      r = OK;
+
+    if (r == OK)
+    {
+      linked += enter_batch(dirp, idx, count, rip->i_num);
+    }
+    else
+    {
+      for (j = 0; j < count; j++)
+        link_batch[idx[j]].lt_status = r;
+    }
+    put_inode(dirp);
+  }
+
+  /* Register all the linking at once. */
+  if (linked > 0)
+  {
+    jr_nlink(rip, rip->i_nlinks + linked);
+    rip->i_nlinks += linked;
+    rip->i_update |= CTIME;
+    IN_MARKDIRTY(rip);
+  }
+  jr_end();
+  put_inode(rip);
+
+  return sys_safecopyto(VFS_PROC_NR, fs_m_in.m_vfs_fs_link.grant,
+                        (vir_bytes)0, (vir_bytes)link_batch, (size_t)len);
+}
+
+/*===========================================================================*
+ *				enter_batch				     *
+ *===========================================================================*/
+static int enter_batch(dirp, idx, count, numb)
+struct inode *dirp; /* directory to enter the names in */
+int idx[];          /* indices of the link_batch targets in dirp */
+int count;          /* number of them */
+ino_t numb;         /* inode number the new entries refer to */
+{
+  /* Enter the names of the given link_batch targets in 'dirp', much like
+   * search_dir() ENTER does for a single name, but scanning the directory
+   * only once: that pass both checks that none of the names exists yet and
+   * collects free slots for them. Names that do not fit in a free slot are
+   * appended, growing the directory as needed. The status of every target
+   * is set and the number of entries made is returned.
+   */
+  off_t free_pos[MFS_LINK_BATCH_MAX]; /* positions of free slots */
+  struct mfs_link_target *lt;
+  struct buf *bp;
+  struct direct *dp;
+  unsigned int block_size;
+  off_t pos;
+  int i, j, nfree, entered;
+
+  if ((dirp->i_mode & I_TYPE) != I_DIRECTORY || dirp->i_sp->s_rd_only)
+  {
+    for (i = 0; i < count; i++)
+      link_batch[idx[i]].lt_status =
+          dirp->i_sp->s_rd_only ? EROFS : ENOTDIR;
+    return (0);
+  }
+
+  /* Reject empty names and names given twice for this directory. */
+  for (i = 0; i < count; i++)
+  {
+    lt = &link_batch[idx[i]];
+    if (lt->lt_status != OK)
+      continue;
+    if (lt->lt_name[0] == '\0')
+      lt->lt_status = ENOENT;
+    for (j = 0; j < i && lt->lt_status == OK; j++)
+      if (strcmp(link_batch[idx[j]].lt_name, lt->lt_name) == 0)
+        lt->lt_status = EEXIST;
+  }
+
+  /* One pass over the directory. */
+  block_size = dirp->i_sp->s_block_size;
+  nfree = 0;
+  for (pos = 0; pos < dirp->i_size; pos += block_size)
+  {
+    bp = get_block_map(dirp, pos);
+    assert(bp != NULL);
+
+    for (dp = &b_dir(bp)[0]; dp < &b_dir(bp)[NR_DIR_ENTRIES(block_size)]; dp++)
+    {
+      if (pos + (dp - &b_dir(bp)[0]) * DIR_ENTRY_SIZE >= dirp->i_size)
+        break;
+      if (dp->mfs_d_ino == NO_ENTRY)
+      {
+        if (nfree < count)
+          free_pos[nfree++] = pos + (dp - &b_dir(bp)[0]) * DIR_ENTRY_SIZE;
+        continue;
+      }
+      for (i = 0; i < count; i++)
+      {
+        lt = &link_batch[idx[i]];
+        if (lt->lt_status == OK &&
+            strncmp(dp->mfs_d_name, lt->lt_name, sizeof(dp->mfs_d_name)) == 0)
+          lt->lt_status = EEXIST;
+      }
+    }
+    put_block(bp, DIRECTORY_BLOCK);
+  }
+
+  /* The names that go in free slots cannot fail, so they are logged with
+   * one write. An appended one is logged once it has its block.
+   */
+  for (i = 0, j = 0; i < count && j < nfree; i++)
+  {
+    lt = &link_batch[idx[i]];
+    if (lt->lt_status == OK)
+    {
+      jr_dirent(dirp, lt->lt_name, NO_ENTRY, numb);
+      j++;
+    }
+  }
+  jr_write();
+
+  /* Fill the free slots first, then append. */
+  entered = 0;
+  j = 0;
+  for (i = 0; i < count; i++)
+  {
+    lt = &link_batch[idx[i]];
+    if (lt->lt_status != OK)
+      continue;
+
+    if (j < nfree)
+    {
+      pos = free_pos[j++];
+      bp = get_block_map(dirp, rounddown(pos, block_size));
+    }
+    else
+    {
+      pos = dirp->i_size;
+      if (pos % block_size == 0)
+        bp = new_block(dirp, pos);
+      else
+        bp = get_block_map(dirp, rounddown(pos, block_size));
+      if (bp == NULL)
+      {
+        lt->lt_status = err_code;
+        continue;
+      }
+      dirp->i_size = pos + DIR_ENTRY_SIZE;
+      jr_dirent(dirp, lt->lt_name, NO_ENTRY, numb);
+      jr_write();
+    }
+    assert(bp != NULL);
+
+    dp = &b_dir(bp)[(pos % block_size) / DIR_ENTRY_SIZE];
+    memset(dp->mfs_d_name, 0, sizeof(dp->mfs_d_name));
+    strncpy(dp->mfs_d_name, lt->lt_name, sizeof(dp->mfs_d_name));
+    dp->mfs_d_ino = conv4(dirp->i_sp->s_native, (int)numb);
+    MARKDIRTY(bp);
+    put_block(bp, DIRECTORY_BLOCK);
+
+    if (strcmp(lt->lt_name, dot2) == 0)
+      dirp->i_parent = NO_ENTRY;
+    dc_entered(dirp, lt->lt_name, numb);
+    count_entry(dirp, lt->lt_name, 1);
+    dir_changed(dirp, lt->lt_name);
+    entered++;
+  }
+
+  /* If the pass found fewer free slots than names, all of them are used. */
+  if (nfree < count && j == nfree)
+  {
+    dirp->i_nr_free = 0;
+    dirp->i_free_all = TRUE;
+  }
+
+
+  return (entered);
+}
+
 /*===========================================================================*
  *				fs_unlink				     *
  *===========================================================================*/
@@ -137,7 +481,7 @@ int fs_unlink()
     return (EINVAL);
 
   /* The last directory exists.  Does the file also exist? */
-  rip = advance(rldirp, string, IGN_PERM);
+  rip = dc_advance(rldirp, string);
   r = err_code;
 
   /* If error, return inode. */
@@ -153,6 +497,7 @@ int fs_unlink()
     return (r);
   }
 
+  jr_begin(JR_TX_MAX);
   if (rip->i_sp->s_rd_only)
   {
     r = EROFS;
@@ -173,6 +518,7 @@ int fs_unlink()
   {
     r = remove_dir(rldirp, rip, string); /* call is RMDIR */
   }
+  jr_end();
 
   /* If unlink was possible, it has been done, otherwise it has not. */
   put_inode(rip);
@@ -180,6 +526,718 @@ int fs_unlink()
   return (r);
 }
 
+/*===========================================================================*
+ *				fs_rmtree				     *
+ *===========================================================================*/
+int fs_rmtree()
+{
+  /* Remove a file, or a directory and everything under it, in one request.
+   * What could not be removed is counted in the struct mfs_rmtree copied
+   * back; the request itself only fails if that struct cannot be copied.
+   */
+  struct mfs_rmtree rt;
+  struct inode *dirp, *rip;
+  char name[MFS_NAME_MAX + 1];
+  int r, left;
+
+  if (fs_m_in.m_vfs_fs_getdents.mem_size != sizeof(rt))
+    return (EINVAL);
+  r = sys_safecopyfrom(VFS_PROC_NR, fs_m_in.m_vfs_fs_getdents.grant,
+                       (vir_bytes)0, (vir_bytes)&rt, sizeof(rt));
+  if (r != OK)
+    return r;
+  memcpy(name, rt.rt_name, MFS_NAME_MAX);
+  name[MFS_NAME_MAX] = '\0';
+  rt.rt_removed = rt.rt_kept = rt.rt_failed = 0;
+  rt.rt_error = OK;
+  rt.rt_error_ino = NO_ENTRY;
+
+  if ((dirp = get_inode(fs_dev, fs_m_in.m_vfs_fs_getdents.inode)) == NULL)
+    return (EINVAL);
+
+  rip = dc_advance(dirp, name);
+  r = err_code;
+  if (r == EENTERMOUNT || r == ELEAVEMOUNT)
+  {
+    put_inode(rip);
+    rip = NULL;
+    r = EBUSY;
+  }
+
+  jr_begin(JR_TX_MAX);
+  if (r != OK)
+    rmtree_fail(&rt, r, NO_ENTRY);
+  else if (rip->i_sp->s_rd_only)
+    rmtree_fail(&rt, EROFS, rip->i_num);
+  else if (strcmp(name, dot1) == 0 || strcmp(name, dot2) == 0)
+    rmtree_fail(&rt, EINVAL, rip->i_num);
+  else if ((rip->i_mode & I_TYPE) == I_DIRECTORY)
+    (void)rmtree(dirp, rip, name, &rt);
+  else
+    rmtree_file(dirp, rip, name, &rt, &left);
+  jr_end();
+
+  put_inode(rip);
+  put_inode(dirp);
+
+  return sys_safecopyto(VFS_PROC_NR, fs_m_in.m_vfs_fs_getdents.grant,
+                        (vir_bytes)0, (vir_bytes)&rt, sizeof(rt));
+}
+
+/*===========================================================================*
+ *				rmtree					     *
+ *===========================================================================*/
+static int rmtree(dirp, rip, name, rt)
+struct inode *dirp;      /* directory holding the tree */
+struct inode *rip;       /* the directory at the top of the tree */
+char name[MFS_NAME_MAX]; /* its name in dirp */
+struct mfs_rmtree *rt;   /* where to count what happens */
+{
+  /* Remove the directory 'rip' and everything under it, depth first. The
+   * walk keeps its own stack of the directories it is in, so that a deep
+   * tree does not run MFS out of stack. Each directory is removed once its
+   * last entry is, with remove_dir(); one that keeps entries stays too.
+   * Returns OK if the whole tree is gone.
+   */
+  struct rmtree_frame *f;
+  struct inode *ip, *parent;
+  char ename[MFS_NAME_MAX + 1];
+  ino_t numb;
+  int depth, h, r;
+
+  memset(rmtree_kept, 0, sizeof(rmtree_kept));
+  rmtree_nr_kept = 0;
+
+  dup_inode(rip);
+  f = &rmtree_stack[0];
+  f->rf_dir = rip;
+  f->rf_pos = 0;
+  strcpy(f->rf_name, name);
+  f->rf_left = 0;
+  depth = 0;
+  r = OK;
+
+  while (depth >= 0)
+  {
+    jr_mark(); /* what is gone so far can stay gone */
+    f = &rmtree_stack[depth];
+    if (next_entry(f->rf_dir, &f->rf_pos, ename, &numb))
+    {
+      /* Skip what this walk has renamed to .bak. */
+      for (h = numb & (RMTREE_KEPT - 1); rmtree_kept[h] != NO_ENTRY;
+           h = (h + 1) & (RMTREE_KEPT - 1))
+        if (rmtree_kept[h] == numb)
+          break;
+      if (rmtree_kept[h] == numb)
+      {
+        f->rf_left++;
+        continue;
+      }
+
+      /* With no room left to remember renamed files, a .bak made now
+       * could be found and removed later on. Leave the rest in place.
+       */
+      if (rmtree_nr_kept == RMTREE_KEPT - 1)
+      {
+        rmtree_fail(rt, ENOSPC, numb);
+        f->rf_left++;
+        continue;
+      }
+
+      if ((ip = get_inode(f->rf_dir->i_dev, numb)) == NULL)
+      {
+        rmtree_fail(rt, err_code, numb);
+        f->rf_left++;
+        continue;
+      }
+
+      if ((ip->i_mode & I_TYPE) != I_DIRECTORY)
+      {
+        rmtree_file(f->rf_dir, ip, ename, rt, &f->rf_left);
+        put_inode(ip);
+        continue;
+      }
+
+      /* A directory: go down into it, unless somebody else holds it. */
+      if (ip->i_mountpoint || ip->i_count > 1 || depth + 1 == MAX_DIR_DEPTH)
+      {
+        rmtree_fail(rt, depth + 1 == MAX_DIR_DEPTH ? ELOOP : EBUSY, numb);
+        f->rf_left++;
+        put_inode(ip);
+        continue;
+      }
+      f = &rmtree_stack[++depth];
+      f->rf_dir = ip;
+      f->rf_pos = 0;
+      strcpy(f->rf_name, ename);
+      f->rf_left = 0;
+      continue;
+    }
+
+    /* All entries of this directory have been dealt with: remove it. */
+    parent = (depth > 0 ? rmtree_stack[depth - 1].rf_dir : dirp);
+    if ((r = remove_dir(parent, f->rf_dir, f->rf_name)) == OK)
+    {
+      rt->rt_removed++;
+    }
+    else
+    {
+      if (r != ENOTEMPTY || f->rf_left == 0)
+        rmtree_fail(rt, r, f->rf_dir->i_num);
+      if (depth > 0)
+        rmtree_stack[depth - 1].rf_left++;
+    }
+    put_inode(f->rf_dir);
+    depth--;
+  }
+
+  return (r);
+}
+
+/*===========================================================================*
+ *				rmtree_file				     *
+ *===========================================================================*/
+static void rmtree_file(dirp, rip, name, rt, left)
+struct inode *dirp;      /* directory holding the file */
+struct inode *rip;       /* the file */
+char name[MFS_NAME_MAX]; /* its name in dirp, with room for ".bak" */
+struct mfs_rmtree *rt;   /* where to count what happens */
+int *left;               /* incremented if the file stays */
+{
+  /* Unlink a file for rmtree(), as REQ_UNLINK would, and count the result. */
+  nlink_t nlinks;
+  int h, r;
+
+  nlinks = rip->i_nlinks;
+  r = unlink_file(dirp, rip, name);
+
+  if (r == OK && rip->i_nlinks < nlinks)
+  {
+    rt->rt_removed++;
+    return;
+  }
+
+  (*left)++;
+  if (r == OK)
+  {
+    /* Mode C kept it under another name: remember not to remove that. */
+    rt->rt_kept++;
+    if (rmtree_nr_kept < RMTREE_KEPT - 1)
+    {
+      for (h = rip->i_num & (RMTREE_KEPT - 1); rmtree_kept[h] != NO_ENTRY;
+           h = (h + 1) & (RMTREE_KEPT - 1))
+        ;
+      rmtree_kept[h] = rip->i_num;
+      rmtree_nr_kept++;
+    }
+  }
+  else if (r == EPERM || r == EINPROGRESS)
+  {
+    rt->rt_kept++; /* mode A, or the first deletion in mode B */
+  }
+  else
+  {
+    rmtree_fail(rt, r, rip->i_num);
+  }
+}
+
+/*===========================================================================*
+ *				rmtree_fail				     *
+ *===========================================================================*/
+static void rmtree_fail(rt, r, numb)
+struct mfs_rmtree *rt; /* the counts */
+int r;                 /* why an entry could not be removed */
+ino_t numb;            /* its inode, or NO_ENTRY */
+{
+  if (rt->rt_failed++ == 0)
+  {
+    rt->rt_error = r;
+    rt->rt_error_ino = numb;
+  }
+}
+
+/*===========================================================================*
+ *				next_entry				     *
+ *===========================================================================*/
+static int next_entry(dirp, pos, name, numb)
+struct inode *dirp;          /* directory to read */
+off_t *pos;                  /* where to start; moved past the entry found */
+char name[MFS_NAME_MAX + 1]; /* the name found, NUL terminated */
+ino_t *numb;                 /* the inode number found */
+{
+  /* Find the next entry of 'dirp' other than "." and "..", from '*pos' on.
+   * Returns TRUE if there is one.
+   */
+  struct buf *bp;
+  struct direct *dp;
+  unsigned int block_size;
+
+  block_size = dirp->i_sp->s_block_size;
+  while (*pos < dirp->i_size)
+  {
+    bp = get_block_map(dirp, rounddown(*pos, block_size));
+    assert(bp != NULL);
+
+    for (dp = &b_dir(bp)[(*pos % block_size) / DIR_ENTRY_SIZE];
+         dp < &b_dir(bp)[NR_DIR_ENTRIES(block_size)] && *pos < dirp->i_size;
+         dp++)
+    {
+      *pos += DIR_ENTRY_SIZE;
+      if (dp->mfs_d_ino == NO_ENTRY ||
+          strncmp(dp->mfs_d_name, dot1, sizeof(dp->mfs_d_name)) == 0 ||
+          strncmp(dp->mfs_d_name, dot2, sizeof(dp->mfs_d_name)) == 0)
+        continue;
+
+      memcpy(name, dp->mfs_d_name, MFS_NAME_MAX);
+      name[MFS_NAME_MAX] = '\0';
+      *numb = (ino_t)conv4(dirp->i_sp->s_native, (int)dp->mfs_d_ino);
+      put_block(bp, DIRECTORY_BLOCK);
+      return (TRUE);
+    }
+    put_block(bp, DIRECTORY_BLOCK);
+  }
+  return (FALSE);
+}
+
+/*===========================================================================*
+ *				fs_copytree				     *
+ *===========================================================================*/
+int fs_copytree()
+{
+  /* Copy a file, or a directory and everything under it, to a new name. What
+   * could not be copied is counted in the struct mfs_copytree copied back;
+   * the request itself only fails if that struct cannot be copied.
+   */
+  struct mfs_copytree ct;
+  struct inode *dirp, *dst_dirp, *rip, *ip;
+  char src_name[MFS_NAME_MAX + 1], dst_name[MFS_NAME_MAX + 1];
+  int r;
+
+  if (fs_m_in.m_vfs_fs_getdents.mem_size != sizeof(ct))
+    return (EINVAL);
+  r = sys_safecopyfrom(VFS_PROC_NR, fs_m_in.m_vfs_fs_getdents.grant,
+                       (vir_bytes)0, (vir_bytes)&ct, sizeof(ct));
+  if (r != OK)
+    return r;
+  memcpy(src_name, ct.ct_src_name, MFS_NAME_MAX);
+  src_name[MFS_NAME_MAX] = '\0';
+  memcpy(dst_name, ct.ct_dst_name, MFS_NAME_MAX);
+  dst_name[MFS_NAME_MAX] = '\0';
+  ct.ct_copied = ct.ct_failed = 0;
+  ct.ct_blocks = 0;
+  ct.ct_error = OK;
+  ct.ct_error_ino = NO_ENTRY;
+
+  if ((dirp = get_inode(fs_dev, fs_m_in.m_vfs_fs_getdents.inode)) == NULL)
+    return (EINVAL);
+  if ((dst_dirp = get_inode(fs_dev, ct.ct_dst_dir)) == NULL)
+  {
+    put_inode(dirp);
+    return (EINVAL);
+  }
+
+  rip = dc_advance(dirp, src_name);
+  r = err_code;
+  if (r == EENTERMOUNT || r == ELEAVEMOUNT)
+  {
+    put_inode(rip);
+    rip = NULL;
+    r = EBUSY;
+  }
+
+  /* The copy must get a new name, outside the tree being copied. */
+  if (r == OK)
+  {
+    if ((dst_dirp->i_mode & I_TYPE) != I_DIRECTORY)
+      r = ENOTDIR;
+    else if (dst_dirp->i_nlinks == NO_LINK)
+      r = ENOENT;
+    else if (dst_dirp->i_sp->s_rd_only)
+      r = EROFS;
+    else if (dst_name[0] == '\0' || strcmp(dst_name, dot1) == 0 ||
+             strcmp(dst_name, dot2) == 0)
+      r = EINVAL;
+    else if ((ip = dc_advance(dst_dirp, dst_name)) != NULL)
+    {
+      put_inode(ip);
+      r = EEXIST;
+    }
+    else if (err_code != ENOENT)
+      r = err_code;
+    else if ((rip->i_mode & I_TYPE) == I_DIRECTORY)
+      r = check_superdir(dst_dirp, rip);
+  }
+
+  if (r != OK)
+  {
+    copytree_fail(&ct, r, rip != NULL ? rip->i_num : NO_ENTRY);
+  }
+  else
+  {
+    copytree_zsearch = NO_ZONE;
+    jr_begin(JR_TX_MAX);
+    if ((ip = copy_node(rip, dst_dirp, dst_name, &ct)) != NULL)
+    {
+      if ((rip->i_mode & I_TYPE) == I_DIRECTORY)
+        copytree(rip, ip, &ct);
+      put_inode(ip);
+    }
+    jr_end();
+  }
+
+  put_inode(rip);
+  put_inode(dst_dirp);
+  put_inode(dirp);
+
+  return sys_safecopyto(VFS_PROC_NR, fs_m_in.m_vfs_fs_getdents.grant,
+                        (vir_bytes)0, (vir_bytes)&ct, sizeof(ct));
+}
+
+/*===========================================================================*
+ *				copytree				     *
+ *===========================================================================*/
+static void copytree(src, dst, ct)
+struct inode *src;       /* directory to copy the entries of */
+struct inode *dst;       /* its copy, with only "." and ".." in it yet */
+struct mfs_copytree *ct; /* where to count what happens */
+{
+  /* Copy everything under 'src' to 'dst', depth first. Like rmtree(), the
+   * walk keeps its own stack of the directories it is in.
+   */
+  struct copytree_frame *f;
+  struct inode *sip, *dip;
+  char ename[MFS_NAME_MAX + 1];
+  ino_t numb;
+  int depth;
+
+  dup_inode(src);
+  dup_inode(dst);
+  f = &copytree_stack[0];
+  f->cf_src = src;
+  f->cf_dst = dst;
+  f->cf_pos = 0;
+  depth = 0;
+
+  while (depth >= 0)
+  {
+    jr_mark(); /* what is copied so far can stay */
+    f = &copytree_stack[depth];
+    if (next_entry(f->cf_src, &f->cf_pos, ename, &numb))
+    {
+      if ((sip = get_inode(f->cf_src->i_dev, numb)) == NULL)
+      {
+        copytree_fail(ct, err_code, numb);
+        continue;
+      }
+      if (sip->i_mountpoint ||
+          ((sip->i_mode & I_TYPE) == I_DIRECTORY && depth + 1 == MAX_DIR_DEPTH))
+      {
+        copytree_fail(ct, sip->i_mountpoint ? EBUSY : ELOOP, numb);
+        put_inode(sip);
+        continue;
+      }
+
+      dip = copy_node(sip, f->cf_dst, ename, ct);
+      if (dip != NULL && (sip->i_mode & I_TYPE) == I_DIRECTORY)
+      {
+        f = &copytree_stack[++depth];
+        f->cf_src = sip;
+        f->cf_dst = dip;
+        f->cf_pos = 0;
+        continue;
+      }
+      if (dip != NULL)
+        put_inode(dip);
+      put_inode(sip);
+      continue;
+    }
+
+    /* All entries are in: give the copy the times of the original, which
+     * entering them has moved.
+     */
+    f->cf_dst->i_atime = f->cf_src->i_atime;
+    f->cf_dst->i_mtime = f->cf_src->i_mtime;
+    f->cf_dst->i_mtime_nsec = f->cf_src->i_mtime_nsec;
+    f->cf_dst->i_update &= ~(ATIME | MTIME);
+    IN_MARKDIRTY(f->cf_dst);
+    put_inode(f->cf_src);
+    put_inode(f->cf_dst);
+    depth--;
+  }
+}
+
+/*===========================================================================*
+ *				copy_node				     *
+ *===========================================================================*/
+static struct inode *copy_node(src, dst_dirp, name, ct)
+struct inode *src;       /* file or directory to copy */
+struct inode *dst_dirp;  /* directory to make the copy in */
+char name[MFS_NAME_MAX]; /* name of the copy */
+struct mfs_copytree *ct; /* where to count what happens */
+{
+  /* Make a copy of 'src' under 'name' in 'dst_dirp': the data of a file, or
+   * an empty directory with the same attributes. Return the copy, or NULL if
+   * it could not be made.
+   */
+  struct inode *ip;
+  int dir, r;
+
+  dir = ((src->i_mode & I_TYPE) == I_DIRECTORY);
+  if (dir && dst_dirp->i_nlinks >= LINK_MAX)
+  {
+    copytree_fail(ct, EMLINK, src->i_num);
+    return (NULL);
+  }
+
+  /* Put the inode near its directory's. */
+  ip = alloc_inode_near(dst_dirp->i_dev, src->i_mode, dst_dirp->i_num);
+  if (ip == NULL)
+  {
+    copytree_fail(ct, err_code, src->i_num);
+    return (NULL);
+  }
+  ip->i_uid = src->i_uid;
+  ip->i_gid = src->i_gid;
+  ip->i_atime = src->i_atime;
+  ip->i_mtime = src->i_mtime & (BMODE - 1); /* not half deleted in mode B */
+  ip->i_mtime_nsec = src->i_mtime_nsec;
+  ip->i_update = CTIME;
+
+  if (dir)
+  {
+    /* Nothing is in it yet, so no free slot needs looking for. */
+    ip->i_free_all = TRUE;
+    ip->i_nr_live = 0;
+    ip->i_live_gen = live_gen;
+    r = dir_enter(ip, dot1, ip->i_num);
+    if (r == OK)
+      r = dir_enter(ip, dot2, dst_dirp->i_num);
+  }
+  else
+  {
+    r = copy_data(src, ip, ct);
+  }
+  if (r == OK)
+    r = dir_enter(dst_dirp, name, ip->i_num);
+
+  if (r != OK)
+  {
+    put_inode(ip); /* no links: freed with whatever it got */
+    copytree_fail(ct, r, src->i_num);
+    return (NULL);
+  }
+  dc_entered(dst_dirp, name, ip->i_num);
+
+  if (dir)
+  {
+    jr_nlink(ip, 2);
+    ip->i_nlinks = 2; /* its name and its "." */
+    ip->i_parent = dst_dirp->i_num;
+    jr_nlink(dst_dirp, dst_dirp->i_nlinks + 1);
+    dst_dirp->i_nlinks++; /* its ".." */
+    IN_MARKDIRTY(dst_dirp);
+  }
+  else
+  {
+    jr_nlink(ip, 1);
+    ip->i_nlinks = 1;
+  }
+  IN_MARKDIRTY(ip);
+  ct->ct_copied++;
+  return (ip);
+}
+
+/*===========================================================================*
+ *				copy_data				     *
+ *===========================================================================*/
+static int copy_data(src, dst, ct)
+struct inode *src;       /* file to copy the data of */
+struct inode *dst;       /* new inode to copy it to */
+struct mfs_copytree *ct; /* where to count the blocks */
+{
+  /* Copy the data of 'src' block by block through the block cache, leaving
+   * holes as holes. The zones are taken one after the other from where the
+   * previous copy left off.
+   */
+  struct buf *sbp, *dbp;
+  unsigned int block_size;
+  mode_t type;
+  off_t pos;
+
+  type = src->i_mode & I_TYPE;
+  if (type != I_REGULAR && type != I_SYMBOLIC_LINK)
+  {
+    /* All there is, a device number, is in i_zone. */
+    memcpy(dst->i_zone, src->i_zone, sizeof(dst->i_zone));
+    dst->i_size = src->i_size;
+    return (OK);
+  }
+
+  /* Set the size first, so that a failed copy is freed in full. */
+  dst->i_size = src->i_size;
+  if (copytree_zsearch != NO_ZONE)
+    dst->i_zsearch = copytree_zsearch;
+
+  block_size = src->i_sp->s_block_size;
+  for (pos = 0; pos < src->i_size; pos += block_size)
+  {
+    if ((sbp = get_block_map(src, pos)) == NULL)
+      continue; /* a hole */
+    if ((dbp = new_block(dst, pos)) == NULL)
+    {
+      put_block(sbp, FULL_DATA_BLOCK);
+      return (err_code);
+    }
+    memcpy(b_data(dbp), b_data(sbp), block_size);
+    MARKDIRTY(dbp);
+    put_block(sbp, FULL_DATA_BLOCK);
+    put_block(dbp, FULL_DATA_BLOCK);
+    ct->ct_blocks++;
+  }
+
+  if (dst->i_zsearch != NO_ZONE)
+    copytree_zsearch = dst->i_zsearch;
+  return (OK);
+}
+
+/*===========================================================================*
+ *				copytree_fail				     *
+ *===========================================================================*/
+static void copytree_fail(ct, r, numb)
+struct mfs_copytree *ct; /* the counts */
+int r;                   /* why an entry could not be copied */
+ino_t numb;              /* its inode, or NO_ENTRY */
+{
+  if (ct->ct_failed++ == 0)
+  {
+    ct->ct_error = r;
+    ct->ct_error_ino = numb;
+  }
+}
+
+/*===========================================================================*
+ *				fs_clone				     *
+ *===========================================================================*/
+int fs_clone()
+{
+  /* Make a new file under 'name' that shares the data of a file instead of
+   * copying it. Both map the same zones until one of them writes to one,
+   * which gives the writer its own copy of that zone (see zref.c).
+   */
+#if ZONE_COW
+  struct inode *ip, *rip, *new_ip;
+  char string[MFS_NAME_MAX];
+  phys_bytes len;
+  block_t b;
+  off_t pos;
+  int r, scale, zone_size, zones;
+
+  len = min(fs_m_in.m_vfs_fs_link.path_len, sizeof(string));
+  r = sys_safecopyfrom(VFS_PROC_NR, fs_m_in.m_vfs_fs_link.grant,
+                       (vir_bytes)0, (vir_bytes)string, (size_t)len);
+  if (r != OK)
+    return r;
+  NUL(string, len, sizeof(string));
+
+  if ((rip = get_inode(fs_dev, fs_m_in.m_vfs_fs_link.inode)) == NULL)
+    return (EINVAL);
+  if ((ip = get_inode(fs_dev, fs_m_in.m_vfs_fs_link.dir_ino)) == NULL)
+  {
+    put_inode(rip);
+    return (EINVAL);
+  }
+
+  /* Only the zones of regular files are shared. */
+  r = OK;
+  if ((rip->i_mode & I_TYPE) == I_DIRECTORY)
+    r = EISDIR;
+  else if ((rip->i_mode & I_TYPE) != I_REGULAR)
+    r = EINVAL;
+  else if (ip->i_nlinks == NO_LINK)
+    r = ENOENT;
+  else if (ip->i_sp->s_rd_only)
+    r = EROFS;
+  else if (string[0] == '\0' || strcmp(string, dot1) == 0 ||
+           strcmp(string, dot2) == 0)
+    r = EINVAL;
+  else if ((new_ip = dc_advance(ip, string)) != NULL)
+  {
+    put_inode(new_ip);
+    r = EEXIST;
+  }
+  else if (err_code != ENOENT)
+    r = err_code;
+
+  /* Every zone may need a slot in the table; make sure there are enough, so
+   * that the clone is not left sharing only part of them.
+   */
+  scale = rip->i_sp->s_log_zone_size;
+  zone_size = rip->i_sp->s_block_size << scale;
+  if (r == OK)
+    r = zref_load(rip->i_dev);
+  if (r == OK)
+  {
+    zones = 0;
+    for (pos = 0; pos < rip->i_size; pos += zone_size)
+      if (read_map(rip, pos, 0) != NO_BLOCK)
+        zones++;
+    if (zones > zref_room())
+      r = ENOSPC;
+  }
+
+  new_ip = NULL;
+  jr_begin(JR_TX_MAX);
+  if (r == OK)
+  {
+    if ((new_ip = alloc_inode_near(ip->i_dev, rip->i_mode, ip->i_num)) == NULL)
+      r = err_code;
+  }
+  if (r == OK)
+  {
+    new_ip->i_uid = rip->i_uid;
+    new_ip->i_gid = rip->i_gid;
+    new_ip->i_atime = rip->i_atime;
+    new_ip->i_mtime = rip->i_mtime & (BMODE - 1);
+    new_ip->i_mtime_nsec = rip->i_mtime_nsec;
+    new_ip->i_update = CTIME;
+
+    /* The size goes first, so that a clone that fails is freed in full.
+     * The zones are mapped one by one, each with indirect blocks of its own.
+     */
+    new_ip->i_size = rip->i_size;
+    new_ip->i_shared = TRUE;
+    rip->i_shared = TRUE;
+    IN_MARKDIRTY(rip);
+    for (pos = 0; r == OK && pos < rip->i_size; pos += zone_size)
+    {
+      if ((b = read_map(rip, pos, 0)) == NO_BLOCK)
+        continue; /* a hole */
+      r = write_map(new_ip, pos, (zone_t)(b >> scale), 0);
+      if (r == OK && (r = zref_share(rip->i_dev, (zone_t)(b >> scale))) != OK)
+        (void)write_map(new_ip, pos, NO_ZONE, 0); /* not to be freed */
+    }
+  }
+  if (r == OK)
+    r = dir_enter(ip, string, new_ip->i_num);
+
+  if (r == OK)
+  {
+    dc_entered(ip, string, new_ip->i_num);
+    jr_nlink(new_ip, 1);
+    new_ip->i_nlinks = 1;
+    IN_MARKDIRTY(new_ip);
+  }
+  if (new_ip != NULL)
+    put_inode(new_ip); /* with no links, freed with what it got */
+  jr_end();
+  put_inode(rip);
+  put_inode(ip);
+  return (r);
+#else
+  return (ENOSYS);
+#endif
+}
+
 /*===========================================================================*
  *                             fs_rdlink                                     *
  *===========================================================================*/
@@ -234,8 +1292,8 @@ char dir_name[MFS_NAME_MAX];                                       /* name of di
    */
   int r;
 
-  /* search_dir checks that rip is a directory too. */
-  if ((r = search_dir(rip, "", NULL, IS_EMPTY, IGN_PERM)) != OK)
+  /* dir_is_empty checks that rip is a directory too. */
+  if ((r = dir_is_empty(rip)) != OK)
     return (r);
 
   if (strcmp(dir_name, ".") == 0 || strcmp(dir_name, "..") == 0)
@@ -255,6 +1313,69 @@ char dir_name[MFS_NAME_MAX];                                       /* name of di
   return (OK);
 }
 
+/*===========================================================================*
+ *				get_parent				     *
+ *===========================================================================*/
+static struct inode *get_parent(dirp)
+struct inode *dirp; /* directory whose parent is wanted */
+{
+  /* Return the inode ".." in 'dirp' refers to, or NULL if there is none.
+   * The inode number is cached in 'dirp', so while both stay in the inode
+   * table this is a hash lookup without any directory block access.
+   * Unlike advance(), this does not leave the file system at its root.
+   */
+  ino_t numb;
+
+  if (dirp->i_parent == NO_ENTRY)
+  {
+    if ((err_code = search_dir(dirp, dot2, &numb, LOOK_UP, IGN_PERM)) != OK)
+      return (NULL);
+    dirp->i_parent = numb;
+  }
+  return (get_inode(dirp->i_dev, dirp->i_parent));
+}
+
+/*===========================================================================*
+ *				check_superdir				     *
+ *===========================================================================*/
+static int check_superdir(dirp, rip)
+struct inode *dirp; /* directory to start from */
+struct inode *rip;  /* directory that must not be above it */
+{
+  /* Return EINVAL if 'rip' is 'dirp' or one of its ancestors, OK otherwise.
+   * The walk stops at the root of the file system, as VFS has checked for
+   * cross device renames already.
+   */
+  struct inode *next;
+  int depth, r;
+
+  dup_inode(dirp);
+  for (depth = 0;; depth++)
+  {
+    if (dirp == rip)
+    {
+      r = EINVAL;
+      break;
+    }
+    if (dirp->i_num == ROOT_INODE)
+    {
+      r = OK;
+      break;
+    }
+    if (depth >= MAX_DIR_DEPTH)
+    {
+      r = EINVAL; /* file system loop */
+      break;
+    }
+    next = get_parent(dirp);
+    put_inode(dirp);
+    if ((dirp = next) == NULL)
+      return (EINVAL); /* Missing ".." entry.  Assume the worst. */
+  }
+  put_inode(dirp);
+  return (r);
+}
+
 /*===========================================================================*
  *				unlink utilities			     *
  *===========================================================================*/
@@ -267,69 +1388,180 @@ enum Mode
   None
 };
 
-static enum Mode getCurrentMode(struct inode *dirp)
+/* Mode files, indexed by enum Mode. X.mode puts only its own directory in
+ * mode X, X.rmode puts its directory and the whole subtree below it in mode X.
+ */
+static char *const modeFiles[] = {"A.mode", "B.mode", "C.mode"};
+static char *const rmodeFiles[] = {"A.rmode", "B.rmode", "C.rmode"};
+
+/* How deep getInheritedMode() recurses; above it walks up without caching. */
+#define MODE_MAX_DEPTH 32
+
+/*
+  Checks whether dirp contains a regular file called name.
+*/
+static bool hasModeFile(struct inode *dirp, char *name)
 {
   ino_t numb;
   struct inode *mode_inode;
+  bool found;
 
-  if (search_dir(dirp, "A.mode", &numb, LOOK_UP, IGN_PERM) == OK)
-  {
-    mode_inode = get_inode(dirp->i_dev, (int)numb);
+  if ((err_code = dc_search(dirp, name, &numb)) != OK)
+    return false;
+  if ((mode_inode = get_inode(dirp->i_dev, (int)numb)) == NULL)
+    return false;
 
-    if (S_ISREG((mode_t)mode_inode->i_mode))
-    {
-      put_inode(mode_inode);
-      // file is regular, return - got A mode
-      return A;
-    }
-    put_inode(mode_inode);
-  }
+  found = S_ISREG((mode_t)mode_inode->i_mode);
+  put_inode(mode_inode);
+  return found;
+}
 
-  if (search_dir(dirp, "B.mode", &numb, LOOK_UP, IGN_PERM) == OK)
-  {
-    mode_inode = get_inode(dirp->i_dev, (int)numb);
+/*
+  Returns the first mode out of A, B, C whose file from names is in dirp.
+*/
+static enum Mode findMode(struct inode *dirp, char *const names[])
+{
+  enum Mode m;
 
-    if (S_ISREG((mode_t)mode_inode->i_mode))
-    {
-      put_inode(mode_inode);
-      // file is regular, return - got B mode
-      return B;
-    }
-    put_inode(mode_inode);
+  for (m = A; m < None; m++)
+  {
+    if (hasModeFile(dirp, names[m]))
+      return m;
   }
+  return None;
+}
+
+/*
+  Fills in dirp's cached local modes unless they are still valid.
+  dir_changed() invalidates them when a mode file name is entered or deleted,
+  IN_MARKDIRTY() when an entry changes without the name being known.
+*/
+static void loadLocalModes(struct inode *dirp)
+{
+  if (dirp->i_lmode != NO_MODE_CACHED)
+    return;
+
+  dirp->i_lmode = findMode(dirp, modeFiles);
+  dirp->i_lrmode = findMode(dirp, rmodeFiles);
+}
 
-  if (search_dir(dirp, "C.mode", &numb, LOOK_UP, IGN_PERM) == OK)
+/*
+  Returns the mode imposed on dirp by an X.rmode file in one of its ancestors,
+  walking up through "..". Every ancestor read is marked as depended on, so
+  that a result cached from the walk goes stale with any of them.
+*/
+static enum Mode walkInheritedMode(struct inode *dirp)
+{
+  struct inode *parent;
+  enum Mode m = None;
+  int depth;
+
+  dup_inode(dirp);
+  for (depth = 0; dirp->i_num != ROOT_INODE && depth < MAX_DIR_DEPTH; depth++)
   {
-    mode_inode = get_inode(dirp->i_dev, (int)numb);
+    if ((parent = get_parent(dirp)) == NULL)
+      break;
+    put_inode(dirp);
+    dirp = parent;
+
+    loadLocalModes(dirp);
+    dirp->i_mode_dep = TRUE;
+    if ((m = dirp->i_lrmode) != None)
+      break;
+  }
+  put_inode(dirp);
+  return m;
+}
 
-    if (S_ISREG((mode_t)mode_inode->i_mode))
-    {
-      put_inode(mode_inode);
-      // file is regular, return - got C mode
-      return C;
-    }
-    put_inode(mode_inode);
+/*
+  Returns the mode imposed on dirp by an X.rmode file in one of its ancestors.
+  The result is cached in dirp until mode_gen changes, which happens when a
+  directory it was derived from changes or leaves the inode table, and when
+  a directory is moved elsewhere.
+*/
+static enum Mode getInheritedMode(struct inode *dirp, int depth)
+{
+  struct inode *parent;
+  unsigned int gen = mode_gen;
+  enum Mode m;
+
+  if (dirp->i_imode != NO_MODE_CACHED && dirp->i_imode_gen == gen)
+    return dirp->i_imode;
+
+  if (dirp->i_num == ROOT_INODE)
+  {
+    m = None; /* modes do not cross mount points */
   }
+  else if (depth >= MODE_MAX_DEPTH)
+  {
+    return walkInheritedMode(dirp);
+  }
+  else
+  {
+    if ((parent = get_parent(dirp)) == NULL)
+      return None; /* missing "..", don't remember that */
+
+    loadLocalModes(parent);
+    if ((m = parent->i_lrmode) == None)
+      m = getInheritedMode(parent, depth + 1);
+    parent->i_mode_dep = TRUE;
+    put_inode(parent);
+  }
+
+  dirp->i_imode = m;
+  dirp->i_imode_gen = gen;
+  return m;
+}
+
+/*
+  Returns the mode dirp is in. A X.mode file in dirp wins over a X.rmode file
+  in dirp, which wins over X.rmode files further up the tree.
+*/
+static enum Mode getCurrentMode(struct inode *dirp)
+{
+  loadLocalModes(dirp);
+  if (dirp->i_lmode != None)
+    return dirp->i_lmode;
+  if (dirp->i_lrmode != None)
+    return dirp->i_lrmode;
+  return getInheritedMode(dirp, 0);
+}
 
-  return None;
+/*
+  getCurrentMode(), timed for the statistics if they are compiled in.
+*/
+static enum Mode getCurrentModeTimed(struct inode *dirp)
+{
+#if REQ_STATS
+  u64_t start, end;
+  enum Mode m;
+
+  read_tsc_64(&start);
+  m = getCurrentMode(dirp);
+  read_tsc_64(&end);
+
+  req_stats_add(MFS_STATS_MODE, end - start, OK);
+  return m;
+#else
+  return getCurrentMode(dirp);
+#endif
 }
 
 /*
-  Checks whether file_name is A.mode, B.mode or C.mode
+  Checks whether file_name is one of the mode files (X.mode or X.rmode).
   Returns 1 if it is one of them, 0 otherwise.
 */
 static bool checkFileName(const char *const file_name)
 {
-  if (strcmp(file_name, "A.mode") == 0)
-  {
-    return true;
-  }
-  else if (strcmp(file_name, "B.mode") == 0)
+  enum Mode m;
+
+  for (m = A; m < None; m++)
   {
-    return true;
+    if (strcmp(file_name, modeFiles[m]) == 0 ||
+        strcmp(file_name, rmodeFiles[m]) == 0)
+      return true;
   }
-  else
-    return strcmp(file_name, "C.mode") == 0;
+  return false;
 }
 
 /*
@@ -396,7 +1628,7 @@ char file_name[MFS_NAME_MAX];                                    /* name of file
   if (rip == NULL)
   {
     /* Search for file in directory and try to get its inode. */
-    err_code = search_dir(dirp, file_name, &numb, LOOK_UP, IGN_PERM);
+    err_code = dc_search(dirp, file_name, &numb);
     if (err_code == OK)
       rip = get_inode(dirp->i_dev, (int)numb);
     if (err_code != OK || rip == NULL)
@@ -409,7 +1641,7 @@ char file_name[MFS_NAME_MAX];                                    /* name of file
 
   if (!checkFileName(file_name) && isRegularFile(rip))
   {
-    enum Mode m = getCurrentMode(dirp);
+    enum Mode m = getCurrentModeTimed(dirp);
     switch (m)
     {
     case A:
@@ -445,7 +1677,7 @@ char file_name[MFS_NAME_MAX];                                    /* name of file
 
       addBakToFileName(file_name);
 
-      if (search_dir(dirp, file_name, &number, LOOK_UP, IGN_PERM) == OK) // check, whether old_name.bak already exists
+      if (dc_search(dirp, file_name, &number) == OK) // check, whether old_name.bak already exists
       {
         fileBak = get_inode(dirp->i_dev, (int)number);
         if (fileBak == NULL || S_ISREG((mode_t)fileBak->i_mode))
@@ -464,15 +1696,16 @@ char file_name[MFS_NAME_MAX];                                    /* name of file
 
       numb = rip->i_num;
 
-      r = search_dir(dirp, file_name, &numb, ENTER,
-                     IGN_PERM);
+      r = dir_enter(dirp, file_name, numb);
 
       if (r == OK)
       {
+        dc_entered(dirp, file_name, numb);
         deleteBakFromFileName(file_name);
-        r = search_dir(dirp, file_name, NULL, DELETE, IGN_PERM); // delete old_name
+        r = dir_delete(dirp, file_name); // delete old_name
         if (r == OK)
         {
+          dc_deleted(dirp, file_name);
           rip->i_update |= CTIME;
           IN_MARKDIRTY(rip);
         }
@@ -487,10 +1720,15 @@ char file_name[MFS_NAME_MAX];                                    /* name of file
   }
 }
 
-r = search_dir(dirp, file_name, NULL, DELETE, IGN_PERM);
+r = dir_delete(dirp, file_name);
+
+if (r == OK && strcmp(file_name, dot2) == 0)
+  dirp->i_parent = NO_ENTRY;
 
 if (r == OK)
 {
+  dc_deleted(dirp, file_name);
+  jr_nlink(rip, rip->i_nlinks - 1);
   rip->i_nlinks--; /* entry deleted from parent's dir */
   rip->i_update |= CTIME;
   IN_MARKDIRTY(rip);
@@ -508,14 +1746,19 @@ int fs_rename()
   /* Perform the rename(name1, name2) system call. */
   struct inode *old_dirp, *old_ip; /* ptrs to old dir, file inodes */
   struct inode *new_dirp, *new_ip; /* ptrs to new dir, file inodes */
-  struct inode *new_superdirp, *next_new_superdirp;
   int r = OK;     /* error flag; initially no error */
   int odir, ndir; /* TRUE iff {old|new} file is dir */
   int same_pdir;  /* TRUE iff parent dirs are the same */
+  int flags;      /* RENAME_NOREPLACE, RENAME_EXCHANGE */
   char old_name[MFS_NAME_MAX], new_name[MFS_NAME_MAX];
   ino_t numb;
   phys_bytes len;
 
+  flags = MFS_RENAME_FLAGS(&fs_m_in);
+  if ((flags & ~(RENAME_NOREPLACE | RENAME_EXCHANGE)) != 0 ||
+      ((flags & RENAME_NOREPLACE) && (flags & RENAME_EXCHANGE)))
+    return (EINVAL);
+
   /* Copy the last component of the old name */
   len = min((unsigned)fs_m_in.m_vfs_fs_rename.len_old, sizeof(old_name));
   r = sys_safecopyfrom(VFS_PROC_NR, fs_m_in.m_vfs_fs_rename.grant_old,
@@ -536,7 +1779,7 @@ int fs_rename()
   if ((old_dirp = get_inode(fs_dev, fs_m_in.m_vfs_fs_rename.dir_old)) == NULL)
     return (err_code);
 
-  old_ip = advance(old_dirp, old_name, IGN_PERM);
+  old_ip = dc_advance(old_dirp, old_name);
   r = err_code;
 
   if (r == EENTERMOUNT || r == ELEAVEMOUNT)
@@ -573,7 +1816,8 @@ int fs_rename()
     }
   }
 
-  new_ip = advance(new_dirp, new_name, IGN_PERM); /* not required to exist */
+  /* not required to exist */
+  new_ip = dc_advance(new_dirp, new_name);
 
   /* However, if the check failed because the file does exist, don't continue.
    * Note that ELEAVEMOUNT is covered by the dot-dot check later. */
@@ -584,6 +1828,21 @@ int fs_rename()
     r = EBUSY;
   }
 
+  if (flags & RENAME_EXCHANGE)
+  {
+    jr_begin(JR_TX_MAX);
+    if (r == OK)
+      r = exchange_entries(old_dirp, old_ip, old_name, new_dirp, new_ip,
+                           new_name);
+    jr_end();
+
+    put_inode(old_dirp);
+    put_inode(old_ip);
+    put_inode(new_dirp);
+    put_inode(new_ip);
+    return (r == SAME ? OK : r);
+  }
+
   odir = ((old_ip->i_mode & I_TYPE) == I_DIRECTORY); /* TRUE iff dir */
 
   /* If it is ok, check for a variety of possible errors. */
@@ -593,42 +1852,7 @@ int fs_rename()
 
     /* The old inode must not be a superdirectory of the new last dir. */
     if (odir && !same_pdir)
-    {
-      dup_inode(new_superdirp = new_dirp);
-      while (TRUE)
-      { /* may hang in a file system loop */
-        if (new_superdirp == old_ip)
-        {
-          put_inode(new_superdirp);
-          r = EINVAL;
-          break;
-        }
-        next_new_superdirp = advance(new_superdirp, dot2,
-                                     IGN_PERM);
-
-        put_inode(new_superdirp);
-        if (next_new_superdirp == new_superdirp)
-        {
-          put_inode(new_superdirp);
-          break;
-        }
-        if (err_code == ELEAVEMOUNT)
-        {
-          /* imitate that we are back at the root,
-				 * cross device checked already on VFS */
-          put_inode(next_new_superdirp);
-          err_code = OK;
-          break;
-        }
-        new_superdirp = next_new_superdirp;
-        if (new_superdirp == NULL)
-        {
-          /* Missing ".." entry.  Assume the worst. */
-          r = EINVAL;
-          break;
-        }
-      }
-    }
+      r = check_superdir(new_dirp, old_ip);
 
     /* The old or new name must not be . or .. */
     if (strcmp(old_name, ".") == 0 || strcmp(old_name, "..") == 0 ||
@@ -660,6 +1884,12 @@ int fs_rename()
         r = ENOTDIR;
       if (odir == FALSE && ndir == TRUE)
         r = EISDIR;
+
+      /* No need for the caller to probe for 'new' first. Whatever 'new' is,
+       * it exists, which is the error to report, as Linux does; only bad
+       * names are reported first. */
+      if ((flags & RENAME_NOREPLACE) && r != EINVAL)
+        r = EEXIST;
     }
   }
 
@@ -675,6 +1905,7 @@ int fs_rename()
    *     [directory has to grow by one block and cannot because the disk
    *      is completely full].
    */
+  jr_begin(JR_TX_MAX);
   if (r == OK)
   {
     if (new_ip != NULL)
@@ -692,43 +1923,50 @@ int fs_rename()
   if (r == OK)
   {
     /* If the new name will be in the same parent directory as the old
-	   * one, first remove the old name to free an entry for the new name,
-	   * otherwise first try to create the new name entry to make sure
-	   * the rename will succeed.
+	   * one, overwrite the name of the old entry in place, otherwise first
+	   * try to create the new name entry to make sure the rename will
+	   * succeed.
 	   */
     numb = old_ip->i_num; /* inode number of old file */
 
     if (same_pdir)
     {
-      r = search_dir(old_dirp, old_name, NULL, DELETE, IGN_PERM);
-      /* shouldn't go wrong. */
-      if (r == OK)
-        (void)search_dir(old_dirp, new_name, &numb, ENTER,
-                         IGN_PERM);
+      /* Just rename the old entry where it is. */
+      r = rewrite_dir_entry(old_dirp, old_name, new_name, numb);
     }
     else
     {
-      r = search_dir(new_dirp, new_name, &numb, ENTER, IGN_PERM);
+      r = dir_enter(new_dirp, new_name, numb);
       if (r == OK)
-        (void)search_dir(old_dirp, old_name, NULL, DELETE,
-                         IGN_PERM);
+      {
+        dc_entered(new_dirp, new_name, numb);
+        if (dir_delete(old_dirp, old_name) == OK)
+          dc_deleted(old_dirp, old_name);
+      }
     }
   }
   /* If r is OK, the ctime and mtime of old_dirp and new_dirp have been marked
-   * for update in search_dir. */
+   * for update in search_dir or rewrite_dir_entry. */
 
   if (r == OK && odir && !same_pdir)
   {
+    /* The subtree now inherits its mode from somewhere else. */
+    mode_gen++;
+
     /* Update the .. entry in the directory (still points to old_dirp).*/
     numb = new_dirp->i_num;
     (void)unlink_file(old_ip, NULL, dot2);
-    if (search_dir(old_ip, dot2, &numb, ENTER, IGN_PERM) == OK)
+    if (dir_enter(old_ip, dot2, numb) == OK)
     {
+      dc_entered(old_ip, dot2, numb);
       /* New link created. */
+      old_ip->i_parent = numb;
+      jr_nlink(new_dirp, new_dirp->i_nlinks + 1);
       new_dirp->i_nlinks++;
       IN_MARKDIRTY(new_dirp);
     }
   }
+  jr_end();
 
   if (strcmp(old_name, new_name) == 0 && same_pdir)
   {
@@ -747,6 +1985,595 @@ int fs_rename()
   return (r == SAME ? OK : r);
 }
 
+/*===========================================================================*
+ *				exchange_entries			     *
+ *===========================================================================*/
+static int exchange_entries(old_dirp, old_ip, old_name, new_dirp, new_ip,
+                            new_name)
+struct inode *old_dirp, *old_ip;   /* old dir and the file in it */
+char old_name[MFS_NAME_MAX];       /* name of the file in old_dirp */
+struct inode *new_dirp, *new_ip;   /* new dir and the file in it */
+char new_name[MFS_NAME_MAX];       /* name of the file in new_dirp */
+{
+  /* Swap the files 'old_name' and 'new_name' by exchanging the inode numbers
+   * of their directory slots in place, so that both names exist at all times
+   * and no entry is removed or created. Nothing is deleted, so the deletion
+   * modes of the two directories do not apply.
+   */
+  int odir, ndir; /* TRUE iff {old|new} file is dir */
+  int same_pdir;  /* TRUE iff parent dirs are the same */
+  int r;
+
+  if (new_ip == NULL)
+    return (ENOENT); /* both names have to exist */
+  if (strcmp(old_name, ".") == 0 || strcmp(old_name, "..") == 0 ||
+      strcmp(new_name, ".") == 0 || strcmp(new_name, "..") == 0)
+    return (EINVAL);
+  if (old_ip == new_ip)
+    return (SAME);
+
+  odir = ((old_ip->i_mode & I_TYPE) == I_DIRECTORY);
+  ndir = ((new_ip->i_mode & I_TYPE) == I_DIRECTORY);
+  same_pdir = (old_dirp == new_dirp);
+
+  if (!same_pdir)
+  {
+    /* Neither directory may end up inside itself. */
+    if (odir && (r = check_superdir(new_dirp, old_ip)) != OK)
+      return (r);
+    if (ndir && (r = check_superdir(old_dirp, new_ip)) != OK)
+      return (r);
+
+    /* A directory moving in adds a link (its "..") to its new parent. */
+    if (odir && !ndir && new_dirp->i_nlinks >= LINK_MAX)
+      return (EMLINK);
+    if (ndir && !odir && old_dirp->i_nlinks >= LINK_MAX)
+      return (EMLINK);
+  }
+
+  if ((r = rewrite_dir_entry(old_dirp, old_name, NULL, new_ip->i_num)) != OK)
+    return (r);
+  if ((r = rewrite_dir_entry(new_dirp, new_name, NULL, old_ip->i_num)) != OK)
+  {
+    (void)rewrite_dir_entry(old_dirp, old_name, NULL, old_ip->i_num);
+    return (r);
+  }
+
+  if (!same_pdir && (odir || ndir))
+  {
+    /* Point ".." of the moved directories at their new parents. */
+    if (odir && rewrite_dir_entry(old_ip, dot2, NULL, new_dirp->i_num) == OK)
+      old_ip->i_parent = new_dirp->i_num;
+    if (ndir && rewrite_dir_entry(new_ip, dot2, NULL, old_dirp->i_num) == OK)
+      new_ip->i_parent = old_dirp->i_num;
+
+    if (odir != ndir)
+    {
+      /* Only one directory moved, so one parent gains a link and the other
+       * loses one.
+       */
+      if (odir)
+      {
+        jr_nlink(new_dirp, new_dirp->i_nlinks + 1);
+        new_dirp->i_nlinks++;
+        jr_nlink(old_dirp, old_dirp->i_nlinks - 1);
+        old_dirp->i_nlinks--;
+      }
+      else
+      {
+        jr_nlink(old_dirp, old_dirp->i_nlinks + 1);
+        old_dirp->i_nlinks++;
+        jr_nlink(new_dirp, new_dirp->i_nlinks - 1);
+        new_dirp->i_nlinks--;
+      }
+      IN_MARKDIRTY(old_dirp);
+      IN_MARKDIRTY(new_dirp);
+    }
+
+    /* The subtrees now inherit their mode from somewhere else. */
+    mode_gen++;
+  }
+
+  old_ip->i_update |= CTIME;
+  IN_MARKDIRTY(old_ip);
+  new_ip->i_update |= CTIME;
+  IN_MARKDIRTY(new_ip);
+
+  return (OK);
+}
+
+/*===========================================================================*
+ *				rewrite_dir_entry			     *
+ *===========================================================================*/
+static int rewrite_dir_entry(dirp, name, new_name, numb)
+struct inode *dirp;      /* directory to change */
+char name[MFS_NAME_MAX]; /* name of the entry to change */
+char *new_name;          /* name to give it, or NULL to keep 'name' */
+ino_t numb;              /* inode number the entry is to refer to */
+{
+  /* Make the existing entry 'name' in 'dirp' refer to inode 'numb' and, if
+   * 'new_name' is given, rename it. Unlike a search_dir() DELETE followed by
+   * an ENTER, the entry stays in place the whole time, the directory is
+   * scanned once and only the block holding the entry is dirtied.
+   */
+  struct buf *bp;
+  struct direct *dp;
+  unsigned int block_size;
+  off_t pos;
+  ino_t old;
+
+  if (dirp->i_sp->s_rd_only)
+    return (EROFS);
+
+  block_size = dirp->i_sp->s_block_size;
+  for (pos = 0; pos < dirp->i_size; pos += block_size)
+  {
+    bp = get_block_map(dirp, pos);
+    assert(bp != NULL);
+
+    for (dp = &b_dir(bp)[0]; dp < &b_dir(bp)[NR_DIR_ENTRIES(block_size)]; dp++)
+    {
+      if (dp->mfs_d_ino != NO_ENTRY &&
+          strncmp(dp->mfs_d_name, name, sizeof(dp->mfs_d_name)) == 0)
+      {
+        old = (ino_t)conv4(dirp->i_sp->s_native, (int)dp->mfs_d_ino);
+        if (new_name != NULL)
+        {
+          jr_dirent(dirp, name, old, NO_ENTRY);
+          jr_dirent(dirp, new_name, NO_ENTRY, numb);
+        }
+        else
+        {
+          jr_dirent(dirp, name, old, numb);
+        }
+        jr_write();
+
+        dp->mfs_d_ino = conv4(dirp->i_sp->s_native, (int)numb);
+        if (new_name != NULL)
+        {
+          strncpy(dp->mfs_d_name, new_name, sizeof(dp->mfs_d_name));
+          dc_deleted(dirp, name);
+        }
+        dc_entered(dirp, new_name != NULL ? new_name : name, numb);
+        MARKDIRTY(bp);
+        put_block(bp, DIRECTORY_BLOCK);
+
+        dir_changed(dirp, name);
+        if (new_name != NULL)
+          dir_changed(dirp, new_name);
+        return (OK);
+      }
+    }
+    put_block(bp, DIRECTORY_BLOCK);
+  }
+
+  return (ENOENT);
+}
+
+/*===========================================================================*
+ *				dir_enter				     *
+ *===========================================================================*/
+static int dir_enter(dirp, name, numb)
+struct inode *dirp;      /* directory to enter the name in */
+char name[MFS_NAME_MAX]; /* name to enter; the caller made sure it is new */
+ino_t numb;              /* inode number the entry is to refer to */
+{
+  /* Enter 'name' in 'dirp' like search_dir() ENTER, but without scanning the
+   * directory when its free slots are known: the entry goes in a slot left
+   * by dir_delete() or, if the directory has none, at the end. Slots are
+   * checked before use, since search_dir() may have filled them since.
+   */
+  struct buf *bp;
+  struct direct *dp;
+  unsigned int block_size;
+  off_t pos, old_size;
+  int r;
+
+  if ((dirp->i_mode & I_TYPE) != I_DIRECTORY)
+    return (ENOTDIR);
+  if (dirp->i_sp->s_rd_only)
+    return (EROFS);
+
+  /* Log the entry before any block holds it; take it back if it fails. */
+  jr_dirent(dirp, name, NO_ENTRY, numb);
+  jr_write();
+
+  block_size = dirp->i_sp->s_block_size;
+  bp = NULL;
+  while (bp == NULL && dirp->i_nr_free > 0)
+  {
+    pos = dirp->i_free_slot[--dirp->i_nr_free];
+    if (pos >= dirp->i_size)
+      continue;
+    bp = get_block_map(dirp, rounddown(pos, block_size));
+    assert(bp != NULL);
+    if (b_dir(bp)[(pos % block_size) / DIR_ENTRY_SIZE].mfs_d_ino != NO_ENTRY)
+    {
+      put_block(bp, DIRECTORY_BLOCK);
+      bp = NULL;
+    }
+  }
+
+  if (bp == NULL && !dirp->i_free_all)
+  {
+    /* Other free slots may exist: have search_dir() look for one. If it
+     * had to grow the directory, there were none.
+     */
+    old_size = dirp->i_size;
+    r = search_dir(dirp, name, &numb, ENTER, IGN_PERM);
+    if (r == OK && dirp->i_size > old_size)
+      dirp->i_free_all = TRUE;
+    if (r == OK)
+      count_entry(dirp, name, 1);
+    else
+      jr_cancel();
+    return (r);
+  }
+
+  if (bp == NULL)
+  {
+    /* No free slot: append, growing the directory if needed. */
+    pos = dirp->i_size;
+    if (pos % block_size == 0)
+      bp = new_block(dirp, pos);
+    else
+      bp = get_block_map(dirp, rounddown(pos, block_size));
+    if (bp == NULL)
+    {
+      jr_cancel();
+      return (err_code);
+    }
+    dirp->i_size = pos + DIR_ENTRY_SIZE;
+  }
+
+  dp = &b_dir(bp)[(pos % block_size) / DIR_ENTRY_SIZE];
+  memset(dp->mfs_d_name, 0, sizeof(dp->mfs_d_name));
+  strncpy(dp->mfs_d_name, name, sizeof(dp->mfs_d_name));
+  dp->mfs_d_ino = conv4(dirp->i_sp->s_native, (int)numb);
+  MARKDIRTY(bp);
+  put_block(bp, DIRECTORY_BLOCK);
+  count_entry(dirp, name, 1);
+  dir_changed(dirp, name);
+  return (OK);
+}
+
+/*===========================================================================*
+ *				dir_delete				     *
+ *===========================================================================*/
+static int dir_delete(dirp, name)
+struct inode *dirp;      /* directory to remove the name from */
+char name[MFS_NAME_MAX]; /* name to remove */
+{
+  /* Remove 'name' from 'dirp' like search_dir() DELETE, and remember the
+   * slot it leaves for dir_enter().
+   */
+  struct buf *bp;
+  struct direct *dp;
+  unsigned int block_size;
+  off_t pos;
+  int t;
+
+  if ((dirp->i_mode & I_TYPE) != I_DIRECTORY)
+    return (ENOTDIR);
+  if (dirp->i_sp->s_rd_only)
+    return (EROFS);
+
+  block_size = dirp->i_sp->s_block_size;
+  for (pos = 0; pos < dirp->i_size; pos += block_size)
+  {
+    bp = get_block_map(dirp, pos);
+    assert(bp != NULL);
+
+    for (dp = &b_dir(bp)[0]; dp < &b_dir(bp)[NR_DIR_ENTRIES(block_size)]; dp++)
+    {
+      if (dp->mfs_d_ino == NO_ENTRY ||
+          strncmp(dp->mfs_d_name, name, sizeof(dp->mfs_d_name)) != 0)
+        continue;
+
+      jr_dirent(dirp, name,
+                (ino_t)conv4(dirp->i_sp->s_native, (int)dp->mfs_d_ino),
+                NO_ENTRY);
+      jr_write();
+
+      /* Save d_ino for recovery, as search_dir() does. */
+      t = MFS_NAME_MAX - sizeof(ino_t);
+      *((ino_t *)&dp->mfs_d_name[t]) = dp->mfs_d_ino;
+      dp->mfs_d_ino = NO_ENTRY;
+      pos += (dp - &b_dir(bp)[0]) * DIR_ENTRY_SIZE;
+      MARKDIRTY(bp);
+      put_block(bp, DIRECTORY_BLOCK);
+
+      if (pos < dirp->i_last_dpos)
+        dirp->i_last_dpos = pos;
+      if (dirp->i_nr_free < DIR_FREE_SLOTS)
+        dirp->i_free_slot[dirp->i_nr_free++] = pos;
+      else
+        dirp->i_free_all = FALSE; /* one slot goes unrecorded */
+      count_entry(dirp, name, -1);
+      dir_changed(dirp, name);
+      if (pos >= dirp->i_size - DIR_ENTRY_SIZE)
+        dir_trim(dirp);
+      return (OK);
+    }
+    put_block(bp, DIRECTORY_BLOCK);
+  }
+
+  return (ENOENT);
+}
+
+/*===========================================================================*
+ *				replay_dirent				     *
+ *===========================================================================*/
+int replay_dirent(dirp, name, from, to)
+struct inode *dirp;      /* directory a journal record is about */
+char name[MFS_NAME_MAX]; /* the name in it */
+ino_t from;              /* what it has to refer to now, NO_ENTRY: absent */
+ino_t to;                /* what it is to refer to, NO_ENTRY: absent */
+{
+  /* Make 'name' in 'dirp' refer to 'to' for the journal replay, but only if
+   * it refers to 'from' now. Anything else means the entry changed after
+   * the record was made, and it is left as it is.
+   */
+  ino_t numb;
+  int r;
+
+  r = dc_search(dirp, name, &numb);
+  if (r == ENOENT)
+    numb = NO_ENTRY;
+  else if (r != OK)
+    return (r);
+  if (numb != from || from == to)
+    return (OK);
+
+  if (from == NO_ENTRY)
+  {
+    if ((r = dir_enter(dirp, name, to)) == OK)
+      dc_entered(dirp, name, to);
+  }
+  else if (to == NO_ENTRY)
+  {
+    if ((r = dir_delete(dirp, name)) == OK)
+      dc_deleted(dirp, name);
+  }
+  else
+  {
+    r = rewrite_dir_entry(dirp, name, NULL, to);
+  }
+  if (r == OK && strcmp(name, dot2) == 0)
+    dirp->i_parent = NO_ENTRY;
+  return (r);
+}
+
+/*===========================================================================*
+ *				dir_trim				     *
+ *===========================================================================*/
+static void dir_trim(dirp)
+struct inode *dirp; /* directory whose last entry was just deleted */
+{
+  /* Cut off the free slots at the end of 'dirp', giving back the blocks
+   * they leave unused. No live entry moves, so a reader part way through
+   * the directory is not disturbed. A directory with no entries left at
+   * all is about to be removed and is left alone.
+   */
+  struct buf *bp;
+  struct direct *dp;
+  unsigned int block_size;
+  off_t pos, new_size;
+  signed char lmode, lrmode;
+  char mode_dep;
+
+  block_size = dirp->i_sp->s_block_size;
+  new_size = dirp->i_size;
+  while (new_size > 0)
+  {
+    pos = rounddown(new_size - 1, block_size);
+    bp = get_block_map(dirp, pos);
+    assert(bp != NULL);
+    dp = &b_dir(bp)[(new_size - pos) / DIR_ENTRY_SIZE];
+    while (dp > &b_dir(bp)[0] && (dp - 1)->mfs_d_ino == NO_ENTRY)
+      dp--;
+    new_size = pos + (dp - &b_dir(bp)[0]) * DIR_ENTRY_SIZE;
+    put_block(bp, DIRECTORY_BLOCK);
+    if (new_size > pos || pos == 0)
+      break; /* a live entry, or the first block */
+  }
+  if (new_size > 0 && new_size < dirp->i_size)
+  {
+    /* No name goes away, so the cached modes stay valid. */
+    lmode = dirp->i_lmode;
+    lrmode = dirp->i_lrmode;
+    mode_dep = dirp->i_mode_dep;
+    dirp->i_mode_dep = FALSE;
+    (void)truncate_inode(dirp, new_size);
+    dirp->i_lmode = lmode;
+    dirp->i_lrmode = lrmode;
+    dirp->i_mode_dep = mode_dep;
+  }
+}
+
+/*===========================================================================*
+ *				count_entry				     *
+ *===========================================================================*/
+static void count_entry(dirp, name, n)
+struct inode *dirp; /* directory a name was entered in or deleted from */
+const char *name;   /* the name */
+int n;              /* 1 if entered, -1 if deleted */
+{
+  /* Keep the entry count of 'dirp' up to date, if it has been counted. */
+  if (dirp->i_nr_live < 0 || dirp->i_live_gen != live_gen)
+    return;
+  if (strcmp(name, dot1) == 0 || strcmp(name, dot2) == 0)
+    return;
+  dirp->i_nr_live += n;
+}
+
+/*===========================================================================*
+ *				dir_changed				     *
+ *===========================================================================*/
+static void dir_changed(dirp, name)
+struct inode *dirp; /* directory a name was entered in or deleted from */
+const char *name;   /* the name */
+{
+  /* Mark 'dirp' changed. Only a mode file can change its modes, so the cached
+   * ones are kept unless 'name' is one.
+   */
+  dirp->i_update |= CTIME | MTIME;
+  IN_MARKDIRTY_KEEPMODE(dirp);
+  if (checkFileName(name))
+    IN_MODECHANGED(dirp);
+}
+
+/*===========================================================================*
+ *				dir_is_empty				     *
+ *===========================================================================*/
+static int dir_is_empty(dirp)
+struct inode *dirp; /* directory to check */
+{
+  /* Return OK if 'dirp' has no entries but "." and "..", like a search_dir()
+   * IS_EMPTY, or ENOTEMPTY. The entries are counted once, by one pass over
+   * the directory; after that the count kept by count_entry() answers
+   * without reading any block.
+   */
+  struct buf *bp;
+  struct direct *dp;
+  unsigned int block_size;
+  off_t pos;
+  int nr_live;
+
+  if ((dirp->i_mode & I_TYPE) != I_DIRECTORY)
+    return (ENOTDIR);
+
+  if (dirp->i_nr_live < 0 || dirp->i_live_gen != live_gen)
+  {
+    block_size = dirp->i_sp->s_block_size;
+    nr_live = 0;
+    for (pos = 0; pos < dirp->i_size; pos += block_size)
+    {
+      bp = get_block_map(dirp, pos);
+      assert(bp != NULL);
+
+      for (dp = &b_dir(bp)[0]; dp < &b_dir(bp)[NR_DIR_ENTRIES(block_size)]; dp++)
+      {
+        if (pos + (dp - &b_dir(bp)[0]) * DIR_ENTRY_SIZE >= dirp->i_size)
+          break;
+        if (dp->mfs_d_ino != NO_ENTRY &&
+            strncmp(dp->mfs_d_name, dot1, sizeof(dp->mfs_d_name)) != 0 &&
+            strncmp(dp->mfs_d_name, dot2, sizeof(dp->mfs_d_name)) != 0)
+          nr_live++;
+      }
+      put_block(bp, DIRECTORY_BLOCK);
+    }
+    dirp->i_nr_live = nr_live;
+    dirp->i_live_gen = live_gen;
+  }
+
+  return (dirp->i_nr_live == 0 ? OK : ENOTEMPTY);
+}
+
+/*===========================================================================*
+ *				dir_compact				     *
+ *===========================================================================*/
+static int dir_compact(dirp)
+struct inode *dirp; /* directory to compact */
+{
+  /* Move the live entries of 'dirp' to the front, keeping their order, and
+   * give back the blocks left unused behind them.
+   */
+  struct buf *bp, *dbp;
+  struct direct *dp, *tdp;
+  unsigned int block_size;
+  off_t pos, spos, dst, dblk;
+  int nr_live;
+
+  block_size = dirp->i_sp->s_block_size;
+  dst = 0;
+  nr_live = 0;
+  dbp = NULL;
+  dblk = 0;
+  for (pos = 0; pos < dirp->i_size; pos += block_size)
+  {
+    bp = get_block_map(dirp, pos);
+    assert(bp != NULL);
+
+    for (dp = &b_dir(bp)[0]; dp < &b_dir(bp)[NR_DIR_ENTRIES(block_size)]; dp++)
+    {
+      spos = pos + (dp - &b_dir(bp)[0]) * DIR_ENTRY_SIZE;
+      if (spos >= dirp->i_size)
+        break;
+      if (dp->mfs_d_ino == NO_ENTRY)
+        continue;
+      if (strncmp(dp->mfs_d_name, dot1, sizeof(dp->mfs_d_name)) != 0 &&
+          strncmp(dp->mfs_d_name, dot2, sizeof(dp->mfs_d_name)) != 0)
+        nr_live++;
+
+      if (spos != dst)
+      {
+        if (rounddown(dst, block_size) == pos)
+        {
+          tdp = &b_dir(bp)[(dst - pos) / DIR_ENTRY_SIZE];
+        }
+        else
+        {
+          if (dbp == NULL || dblk != rounddown(dst, block_size))
+          {
+            if (dbp != NULL)
+              put_block(dbp, DIRECTORY_BLOCK);
+            dblk = rounddown(dst, block_size);
+            dbp = get_block_map(dirp, dblk);
+            assert(dbp != NULL);
+          }
+          tdp = &b_dir(dbp)[(dst - dblk) / DIR_ENTRY_SIZE];
+          MARKDIRTY(dbp);
+        }
+        memcpy(tdp, dp, DIR_ENTRY_SIZE);
+        dp->mfs_d_ino = NO_ENTRY;
+        MARKDIRTY(bp);
+      }
+      dst += DIR_ENTRY_SIZE;
+    }
+    put_block(bp, DIRECTORY_BLOCK);
+  }
+  if (dbp != NULL)
+    put_block(dbp, DIRECTORY_BLOCK);
+
+  /* No slot is free below the new end, and the entries were all seen. */
+  dirp->i_last_dpos = dst;
+  dirp->i_nr_free = 0;
+  dirp->i_free_all = TRUE;
+  dirp->i_nr_live = nr_live;
+  dirp->i_live_gen = live_gen;
+
+  if (dst < dirp->i_size)
+    return (truncate_inode(dirp, dst));
+  return (OK);
+}
+
+/*===========================================================================*
+ *				fs_compact_dir				     *
+ *===========================================================================*/
+int fs_compact_dir(void)
+{
+  /* Compact a directory: pack its entries to the front and free the blocks
+   * that are left empty.
+   */
+  struct inode *rip;
+  int r;
+
+  if ((rip = find_inode(fs_dev, fs_m_in.m_vfs_fs_ftrunc.inode)) == NULL)
+    return (EINVAL);
+
+  if ((rip->i_mode & I_TYPE) != I_DIRECTORY)
+    r = ENOTDIR;
+  else if (rip->i_sp->s_rd_only)
+    r = EROFS;
+  else if (jr_enabled())
+    r = EBUSY; /* the moves are not logged */
+  else
+    r = dir_compact(rip);
+
+  return (r);
+}
+
 /*===========================================================================*
  *				fs_ftrunc				     *
  *===========================================================================*/
@@ -794,6 +2621,8 @@ off_t newsize;                                               /* inode must becom
   int r;
   mode_t file_type;
 
+  TRACE(MFS_TR_TRUNC, rip->i_dev, rip->i_num);
+
   file_type = rip->i_mode & I_TYPE; /* check to see if file is special */
   if (file_type == I_CHAR_SPECIAL || file_type == I_BLOCK_SPECIAL)
     return (EINVAL);
@@ -809,7 +2638,15 @@ off_t newsize;                                               /* inode must becom
 
   /* Clear the rest of the last zone if expanding. */
   if (newsize > rip->i_size)
+  {
+    if ((r = zref_unshare(rip, rip->i_size)) != OK)
+      return (r);
     clear_zone(rip, rip->i_size, 0);
+  }
+
+  /* With no zones left, it shares none. */
+  if (newsize == 0)
+    rip->i_shared = FALSE;
 
   /* Next correct the inode size. */
   rip->i_size = newsize;
@@ -844,6 +2681,7 @@ off_t start, end;                                                    /* range of
     end = rip->i_size;
   if (end <= start) /* end is uninclusive, so start<end */
     return (EINVAL);
+  jr_forget(rip); /* its blocks are not to be written to any more */
 
   zone_size = rip->i_sp->s_block_size << rip->i_sp->s_log_zone_size;
 
@@ -874,6 +2712,9 @@ off_t start, end;                                                    /* range of
       e++;
     for (p = nextblock(start, zone_size) / zone_size; p < e; p++)
     {
+      /* A zone a clone maps too is only unmapped. */
+      if ((r = zref_drop(rip, p * zone_size)) != OK)
+        return (r);
       if ((r = write_map(rip, p * zone_size, NO_ZONE, WMAP_FREE)) != OK)
         return (r);
     }
@@ -956,6 +2797,8 @@ off_t len;
 
   while (len > 0)
   {
+    if (zref_unshare(rip, pos) != OK)
+      return;
     if ((bp = get_block_map(rip, rounddown(pos, block_size))) == NULL)
       return;
     offset = pos % block_size;
@@ -0,0 +1,24 @@
+#ifndef __MFS_MFSPROTO_H__
+#define __MFS_MFSPROTO_H__
+
+/* Function prototypes for the requests and helpers added to MFS here; the
+ * ones MFS has always had are in proto.h.  Those of the optional modules are
+ * in their own headers (reqstats.h, trace.h, dcache.h, zref.h, journal.h).
+ */
+
+/* inode.c */
+struct inode *alloc_inode_near(dev_t dev, mode_t bits, ino_t near);
+
+/* link.c */
+int fs_link_batch(void);
+int fs_compact_dir(void);
+int fs_rmtree(void);
+int fs_copytree(void);
+int fs_clone(void);
+
+/* stadir.c */
+int fs_stat_batch(void);
+int fs_getdents_plus(void);
+int fs_statx(void);
+
+#endif
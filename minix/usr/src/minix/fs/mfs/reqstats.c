@@ -0,0 +1,100 @@
+/* This file keeps the per-request statistics.
+ *
+ * Requests are counted only when they are dispatched through
+ * req_stats_call().  The host build's mfs_host_request() does that; the
+ * main loop in main.c, which is not part of this tree, still calls
+ * fs_call_vec directly.  On MINIX, only the deletion mode entry, which
+ * link.c times itself, is filled in.
+ *
+ * The entry points into this file are
+ *   req_stats_call: call a request handler and account for it
+ *   req_stats_add:  account for one timed piece of work
+ *   fs_reqstats:    copy the statistics to the caller
+ */
+
+#include "fs.h"
+#include <string.h>
+#include <minix/vfsif.h>
+#include "reqstats.h"
+#include "dcache.h"
+
+struct mfs_req_stat req_stats[MFS_STATS_ENTRIES];
+
+/*===========================================================================*
+ *				req_stats_call				     *
+ *===========================================================================*/
+int req_stats_call(
+  int ind,			/* request number minus FS_BASE */
+  int (*handler)(void)		/* handler of the request */
+)
+{
+/* Call the handler of a request.  If statistics are gathered, time it. */
+
+#if REQ_STATS
+  u64_t start, end;
+  int r;
+
+  read_tsc_64(&start);
+  r = handler();
+  read_tsc_64(&end);
+
+  req_stats_add(ind, end - start, r);
+  return(r);
+#else
+  return(handler());
+#endif
+}
+
+/*===========================================================================*
+ *				req_stats_add				     *
+ *===========================================================================*/
+void req_stats_add(
+  int ind,			/* entry to account to */
+  u64_t cycles,			/* how long it took */
+  int r				/* result, OK or an error */
+)
+{
+  struct mfs_req_stat *rs;
+  int bucket;
+
+  if (ind < 0 || ind >= MFS_STATS_ENTRIES) return;
+  rs = &req_stats[ind];
+
+  rs->rs_calls++;
+  if (r != OK) rs->rs_errors++;
+  rs->rs_cycles += cycles;
+
+  /* Bucket i holds the times of 2^i up to 2^(i+1)-1 cycles. */
+  for (bucket = 0; cycles > 1 && bucket < MFS_STATS_BUCKETS - 1; bucket++)
+	cycles >>= 1;
+  rs->rs_hist[bucket]++;
+}
+
+/*===========================================================================*
+ *				fs_reqstats				     *
+ *===========================================================================*/
+int fs_reqstats(void)
+{
+/* Copy the statistics table to the caller, and the name cache counts after
+ * it if there is room.  The table is all zeroes if MFS was built without
+ * REQ_STATS.
+ */
+  size_t len;
+  int r;
+
+  len = fs_m_in.m_vfs_fs_getdents.mem_size;
+  if (len > sizeof(req_stats)) len = sizeof(req_stats);
+
+  r = sys_safecopyto(fs_m_in.m_source, fs_m_in.m_vfs_fs_getdents.grant,
+	(vir_bytes) 0, (vir_bytes) req_stats, len);
+  if (r == OK && fs_m_in.m_vfs_fs_getdents.mem_size >=
+      sizeof(req_stats) + sizeof(dc_stats)) {
+	r = sys_safecopyto(fs_m_in.m_source, fs_m_in.m_vfs_fs_getdents.grant,
+		(vir_bytes) len, (vir_bytes) &dc_stats, sizeof(dc_stats));
+	len += sizeof(dc_stats);
+  }
+  if (r != OK) return(r);
+
+  fs_m_out.m_fs_vfs_getdents.nbytes = len;
+  return(OK);
+}
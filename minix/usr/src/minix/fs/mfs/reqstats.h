@@ -0,0 +1,17 @@
+#ifndef __MFS_REQSTATS_H__
+#define __MFS_REQSTATS_H__
+
+/* Per-request statistics: how often each request was handled, how often it
+ * failed, and a histogram of how many TSC cycles it took, in power of two
+ * buckets.  Gathering is compiled in only if REQ_STATS is set in fs.h.
+ */
+
+#include <minix/mfsif.h>
+
+extern struct mfs_req_stat req_stats[MFS_STATS_ENTRIES];
+
+int req_stats_call(int ind, int (*handler)(void));
+void req_stats_add(int ind, u64_t cycles, int r);
+int fs_reqstats(void);
+
+#endif
@@ -1,11 +1,38 @@
 #include "fs.h"
+#include <stddef.h>
 #include <string.h>
 #include <assert.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
 #include "inode.h"
 #include "super.h"
+#include "buf.h"
 #include <minix/vfsif.h>
+#include <minix/mfsif.h>
+
+/* Entries of the REQ_STAT_BATCH request being handled. */
+static struct mfs_stat_ent stat_batch[MFS_STAT_BATCH_MAX];
+
+/* Records of the REQ_GETDENTS_PLUS request being handled, filled and copied
+ * out this many at a time.
+ */
+#define DIRENT_PLUS_CHUNK	32
+static struct mfs_dirent_plus dirent_plus[DIRENT_PLUS_CHUNK];
+
+static int put_dirent_plus(int count, size_t offset);
+
+/* How much of a struct mfs_statx to copy back, by its highest mask bit. */
+static const size_t statx_len[] = {
+  offsetof(struct mfs_statx, sx_mtime),		/* MFS_STATX_SIZE */
+  offsetof(struct mfs_statx, sx_mode),		/* MFS_STATX_MTIME */
+  offsetof(struct mfs_statx, sx_nlink),		/* MFS_STATX_MODE */
+  offsetof(struct mfs_statx, sx_uid),		/* MFS_STATX_NLINK */
+  offsetof(struct mfs_statx, sx_gid),		/* MFS_STATX_UID */
+  offsetof(struct mfs_statx, sx_atime),		/* MFS_STATX_GID */
+  offsetof(struct mfs_statx, sx_ctime),		/* MFS_STATX_ATIME */
+  offsetof(struct mfs_statx, sx_blocks),	/* MFS_STATX_CTIME */
+  sizeof(struct mfs_statx)			/* MFS_STATX_BLOCKS */
+};
 
 /*===========================================================================*
  *				estimate_blocks				     *
@@ -39,19 +66,17 @@ static blkcnt_t estimate_blocks(struct inode *rip)
 }
 
 /*===========================================================================*
- *				stat_inode				     *
+ *				fill_statbuf				     *
  *===========================================================================*/
-static int stat_inode(
+static void fill_statbuf(
   register struct inode *rip,	/* pointer to inode to stat */
-  endpoint_t who_e,		/* Caller endpoint */
-  cp_grant_id_t gid		/* grant for the stat buf */
+  struct stat *statbuf		/* where to put the result */
 )
 {
-/* Common code for stat and fstat system calls. */
+/* Fill in 'statbuf' from the inode. */
 
-  struct stat statbuf;
   mode_t mo;
-  int r, s;
+  int s;
 
   /* Update the atime, ctime, and mtime fields in the inode, if need be. */
   if (rip->i_update) update_times(rip);
@@ -62,21 +87,40 @@ static int stat_inode(
   /* true iff special */
   s = (mo == I_CHAR_SPECIAL || mo == I_BLOCK_SPECIAL);
 
-  memset(&statbuf, 0, sizeof(struct stat));
-
-  statbuf.st_dev = rip->i_dev;
-  statbuf.st_ino = (ino_t) rip->i_num;
-  statbuf.st_mode = (mode_t) rip->i_mode;
-  statbuf.st_nlink = (nlink_t) rip->i_nlinks;
-  statbuf.st_uid = rip->i_uid;
-  statbuf.st_gid = rip->i_gid;
-  statbuf.st_rdev = (s ? (dev_t)rip->i_zone[0] : NO_DEV);
-  statbuf.st_size = rip->i_size;
-  statbuf.st_atime = rip->i_atime;
-  statbuf.st_mtime = rip->i_mtime & (BMODE - 1);
-  statbuf.st_ctime = rip->i_ctime;
-  statbuf.st_blksize = lmfs_fs_block_size();
-  statbuf.st_blocks = estimate_blocks(rip);
+  memset(statbuf, 0, sizeof(struct stat));
+
+  statbuf->st_dev = rip->i_dev;
+  statbuf->st_ino = (ino_t) rip->i_num;
+  statbuf->st_mode = (mode_t) rip->i_mode;
+  statbuf->st_nlink = (nlink_t) rip->i_nlinks;
+  statbuf->st_uid = rip->i_uid;
+  statbuf->st_gid = rip->i_gid;
+  statbuf->st_rdev = (s ? (dev_t)rip->i_zone[0] : NO_DEV);
+  statbuf->st_size = rip->i_size;
+  statbuf->st_atime = rip->i_atime;
+  statbuf->st_mtime = rip->i_mtime & (BMODE - 1);
+  statbuf->st_mtimespec.tv_nsec = rip->i_mtime_nsec;
+  statbuf->st_ctime = rip->i_ctime;
+  statbuf->st_ctimespec.tv_nsec = rip->i_ctime_nsec;
+  statbuf->st_blksize = lmfs_fs_block_size();
+  statbuf->st_blocks = estimate_blocks(rip);
+}
+
+/*===========================================================================*
+ *				stat_inode				     *
+ *===========================================================================*/
+static int stat_inode(
+  register struct inode *rip,	/* pointer to inode to stat */
+  endpoint_t who_e,		/* Caller endpoint */
+  cp_grant_id_t gid		/* grant for the stat buf */
+)
+{
+/* Common code for stat and fstat system calls. */
+
+  struct stat statbuf;
+  int r;
+
+  fill_statbuf(rip, &statbuf);
 
   /* Copy the struct to user space. */
   r = sys_safecopyto(who_e, gid, (vir_bytes) 0, (vir_bytes) &statbuf,
@@ -85,6 +129,64 @@ static int stat_inode(
   return(r);
 }
 
+/*===========================================================================*
+ *                             fs_statx					     *
+ *===========================================================================*/
+int fs_statx()
+{
+/* Like fs_stat, but only compute and copy the fields in the caller's mask.
+ * A caller polling size and mtime thus costs neither a block estimate nor,
+ * unless the mtime is pending, a clock call.
+ */
+  struct mfs_statx sx;
+  struct inode *rip;
+  u32_t mask;
+  size_t len;
+  int i, r;
+
+  r = sys_safecopyfrom(fs_m_in.m_source, fs_m_in.m_vfs_fs_stat.grant,
+		(vir_bytes) 0, (vir_bytes) &sx.sx_mask, sizeof(sx.sx_mask));
+  if (r != OK)
+	return(r);
+  mask = sx.sx_mask & MFS_STATX_ALL;
+
+  if ((rip = get_inode(fs_dev, fs_m_in.m_vfs_fs_stat.inode)) == NULL)
+	return(EINVAL);
+
+  memset(&sx, 0, sizeof(sx));
+  sx.sx_mask = mask;
+
+  if ((mask & (MFS_STATX_ATIME | MFS_STATX_MTIME | MFS_STATX_CTIME)) &&
+      rip->i_update)
+	update_times(rip);
+
+  if (mask & MFS_STATX_SIZE) sx.sx_size = rip->i_size;
+  if (mask & MFS_STATX_MTIME) {
+	sx.sx_mtime = rip->i_mtime & (BMODE - 1);
+	sx.sx_mtime_nsec = rip->i_mtime_nsec;
+  }
+  if (mask & MFS_STATX_MODE) sx.sx_mode = (mode_t) rip->i_mode;
+  if (mask & MFS_STATX_NLINK) sx.sx_nlink = (nlink_t) rip->i_nlinks;
+  if (mask & MFS_STATX_UID) sx.sx_uid = rip->i_uid;
+  if (mask & MFS_STATX_GID) sx.sx_gid = rip->i_gid;
+  if (mask & MFS_STATX_ATIME) sx.sx_atime = rip->i_atime;
+  if (mask & MFS_STATX_CTIME) {
+	sx.sx_ctime = rip->i_ctime;
+	sx.sx_ctime_nsec = rip->i_ctime_nsec;
+  }
+  if (mask & MFS_STATX_BLOCKS) sx.sx_blocks = estimate_blocks(rip);
+
+  put_inode(rip);		/* release the inode */
+
+  /* Copy back up to the last field asked for. */
+  len = sizeof(sx.sx_mask);
+  for (i = 0; (mask >> i) != 0; i++)
+	len = statx_len[i];
+
+  return(sys_safecopyto(fs_m_in.m_source, fs_m_in.m_vfs_fs_stat.grant,
+		(vir_bytes) 0, (vir_bytes) &sx, len));
+}
+
 /*===========================================================================*
  *				fs_statvfs				     *
  *===========================================================================*/
@@ -135,3 +237,173 @@ int fs_stat()
   return(r);
 }
 
+
+
+/*===========================================================================*
+ *                             fs_stat_batch				     *
+ *===========================================================================*/
+int fs_stat_batch()
+{
+/* Stat a vector of inodes at once: the inode numbers come in and the stat
+ * structures go out in a single grant copy each way, instead of one request
+ * per inode.
+ */
+  struct mfs_stat_ent *se;
+  struct inode *rip;
+  struct super_block *sp;
+  size_t len;
+  int n, r;
+
+  len = fs_m_in.m_vfs_fs_getdents.mem_size;
+  n = len / sizeof(stat_batch[0]);
+  if (n <= 0 || n > MFS_STAT_BATCH_MAX || len % sizeof(stat_batch[0]) != 0)
+	return(EINVAL);
+
+  r = sys_safecopyfrom(fs_m_in.m_source, fs_m_in.m_vfs_fs_getdents.grant,
+		(vir_bytes) 0, (vir_bytes) stat_batch, len);
+  if (r != OK)
+	return(r);
+
+  sp = get_super(fs_dev);
+  for (se = &stat_batch[0]; se < &stat_batch[n]; se++) {
+	/* Only numbers that can be inodes go to get_inode(). */
+	if (se->se_ino < ROOT_INODE || se->se_ino > sp->s_ninodes) {
+		se->se_status = EINVAL;
+		continue;
+	}
+	if ((rip = get_inode(fs_dev, se->se_ino)) == NULL) {
+		se->se_status = err_code;
+		continue;
+	}
+	fill_statbuf(rip, &se->se_stat);
+	se->se_status = OK;
+	put_inode(rip);		/* release the inode */
+  }
+
+  return(sys_safecopyto(fs_m_in.m_source, fs_m_in.m_vfs_fs_getdents.grant,
+		(vir_bytes) 0, (vir_bytes) stat_batch, len));
+}
+
+
+/*===========================================================================*
+ *                             fs_getdents_plus				     *
+ *===========================================================================*/
+int fs_getdents_plus()
+{
+/* Read directory entries along with the attributes stat() would give for
+ * them, so that listing a directory with attributes does not need a stat
+ * request per entry.
+ */
+  struct inode *rip;
+  struct buf *bp;
+  struct direct *dp;
+  struct mfs_dirent_plus *de;
+  unsigned int block_size;
+  off_t pos, block_pos;
+  size_t size, copied;
+  int count, r;
+
+  if ((rip = find_inode(fs_dev, fs_m_in.m_vfs_fs_getdents.inode)) == NULL)
+	return(EINVAL);
+  if ((rip->i_mode & I_TYPE) != I_DIRECTORY)
+	return(ENOTDIR);
+
+  pos = fs_m_in.m_vfs_fs_getdents.seek_pos;
+  size = fs_m_in.m_vfs_fs_getdents.mem_size;
+  if (pos < 0 || pos % DIR_ENTRY_SIZE != 0)
+	return(EINVAL);
+  if (size < sizeof(dirent_plus[0]))
+	return(EINVAL);
+
+  block_size = rip->i_sp->s_block_size;
+  copied = 0;
+  count = 0;
+
+  while (pos < rip->i_size && copied + (count + 1) * sizeof(*de) <= size) {
+	block_pos = pos - pos % block_size;
+	bp = get_block_map(rip, block_pos);
+	assert(bp != NULL);
+
+	/* Collect the names and numbers in this block that still fit. */
+	for (dp = &b_dir(bp)[(pos % block_size) / DIR_ENTRY_SIZE];
+	     dp < &b_dir(bp)[NR_DIR_ENTRIES(block_size)] && pos < rip->i_size;
+	     dp++) {
+		if (dp->mfs_d_ino != NO_ENTRY) {
+			if (count == DIRENT_PLUS_CHUNK ||
+			    copied + (count + 1) * sizeof(*de) > size)
+				break;
+			de = &dirent_plus[count++];
+			memset(de, 0, sizeof(*de));
+			memcpy(de->dp_name, dp->mfs_d_name,
+				sizeof(dp->mfs_d_name));
+			de->dp_stat.st_ino = (ino_t) conv4(rip->i_sp->s_native,
+				(int) dp->mfs_d_ino);
+		}
+		pos += DIR_ENTRY_SIZE;
+	}
+	put_block(bp, DIRECTORY_BLOCK);
+
+	if (count == DIRENT_PLUS_CHUNK) {
+		if ((r = put_dirent_plus(count, copied)) != OK)
+			return(r);
+		copied += count * sizeof(*de);
+		count = 0;
+	}
+  }
+
+  if (count > 0) {
+	if ((r = put_dirent_plus(count, copied)) != OK)
+		return(r);
+	copied += count * sizeof(*de);
+  }
+
+  fs_m_out.m_fs_vfs_getdents.seek_pos = pos;
+  fs_m_out.m_fs_vfs_getdents.nbytes = copied;
+
+  /* update_times() dirties the inode if the atime really has to change. */
+  if (!rip->i_sp->s_rd_only)
+	rip->i_update |= ATIME;
+
+  return(OK);
+}
+
+/*===========================================================================*
+ *                             put_dirent_plus				     *
+ *===========================================================================*/
+static int put_dirent_plus(int count, size_t offset)
+{
+/* Fill in the attributes of the first 'count' dirent_plus records and copy
+ * them to the caller at 'offset'.  The inodes are loaded in inode number
+ * order, which is inode block order, so every inode block is fetched once
+ * however the entries are laid out in the directory.
+ */
+  int order[DIRENT_PLUS_CHUNK];
+  struct mfs_dirent_plus *de;
+  struct inode *ip;
+  ino_t ino;
+  int i, j;
+
+  /* Insertion sort of the record indices by inode number. */
+  for (i = 0; i < count; i++) {
+	ino = dirent_plus[i].dp_stat.st_ino;
+	for (j = i; j > 0 && dirent_plus[order[j - 1]].dp_stat.st_ino > ino;
+	     j--)
+		order[j] = order[j - 1];
+	order[j] = i;
+  }
+
+  for (i = 0; i < count; i++) {
+	de = &dirent_plus[order[i]];
+	if ((ip = get_inode(fs_dev, de->dp_stat.st_ino)) == NULL) {
+		de->dp_status = err_code;
+		continue;
+	}
+	fill_statbuf(ip, &de->dp_stat);
+	de->dp_status = OK;
+	put_inode(ip);
+  }
+
+  return(sys_safecopyto(fs_m_in.m_source, fs_m_in.m_vfs_fs_getdents.grant,
+	(vir_bytes) offset, (vir_bytes) dirent_plus,
+	count * sizeof(dirent_plus[0])));
+}
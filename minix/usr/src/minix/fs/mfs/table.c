@@ -0,0 +1,62 @@
+/* This file contains the table used to map system call numbers onto the
+ * routines that perform them.
+ */
+
+#define _TABLE
+
+#include "fs.h"
+#include <minix/mfsif.h>
+#include "inode.h"
+#include "buf.h"
+#include "super.h"
+#include "reqstats.h"
+#include "trace.h"
+
+int (*fs_call_vec[MFS_NREQS])(void) = {
+        no_sys,             /* 0   not used */
+        no_sys,             /* 1   */		/* Was: fs_getnode */
+        fs_putnode,         /* 2   */
+        fs_slink,           /* 3   */
+        fs_ftrunc,          /* 4   */
+        fs_chown,           /* 5   */
+        fs_chmod,           /* 6   */
+        fs_inhibread,       /* 7   */
+        fs_stat,            /* 8   */
+        fs_utime,           /* 9   */
+        fs_statvfs,         /* 10  */
+        fs_breadwrite,      /* 11  */
+        fs_breadwrite,      /* 12  */
+        fs_unlink,          /* 13  */
+        fs_rmdir,           /* 14  */
+        fs_unmount,         /* 15  */
+        fs_sync,            /* 16  */
+        fs_new_driver,      /* 17  */
+        fs_flush,           /* 18  */
+        fs_readwrite,       /* 19  */
+        fs_readwrite,       /* 20  */
+        fs_mknod,           /* 21  */
+        fs_mkdir,           /* 22  */
+        fs_create,          /* 23  */
+        fs_link,            /* 24  */
+        fs_rename,          /* 25  */
+        fs_lookup,          /* 26  */
+        fs_mountpoint,      /* 27  */
+        fs_readsuper,       /* 28  */
+        no_sys,             /* 29  */		/* Was: fs_newnode */
+        fs_rdlink,          /* 30  */
+        fs_getdents,        /* 31  */
+        fs_readwrite,       /* 32  */
+        fs_bpeek,           /* 33  */
+
+	/* The MFS requests of <minix/mfsif.h>. */
+	[REQ_LINK_BATCH - FS_BASE]	= fs_link_batch,
+	[REQ_STAT_BATCH - FS_BASE]	= fs_stat_batch,
+	[REQ_GETDENTS_PLUS - FS_BASE]	= fs_getdents_plus,
+	[REQ_STATX - FS_BASE]		= fs_statx,
+	[REQ_MFS_STATS - FS_BASE]	= fs_reqstats,
+	[REQ_MFS_TRACE - FS_BASE]	= fs_trace,
+	[REQ_MFS_COMPACT - FS_BASE]	= fs_compact_dir,
+	[REQ_RMTREE - FS_BASE]		= fs_rmtree,
+	[REQ_COPYTREE - FS_BASE]	= fs_copytree,
+	[REQ_CLONE - FS_BASE]		= fs_clone,
+};
@@ -38,7 +38,7 @@ int fs_utime()
 		 */
 		rip->i_atime = fs_m_in.m_vfs_fs_utime.actime;
 		/*
-		 * MFS does not support better than second resolution,
+		 * MFS does not keep the atime better than to the second,
 		 * so we discard ACNSEC to round down
 		 */
 		break;
@@ -64,12 +64,13 @@ int fs_utime()
 		{
 			rip->i_mtime = fs_m_in.m_vfs_fs_utime.modtime;
 		}
-		
 
 		/*
-		 * MFS does not support better than second resolution,
-		 * so we discard MODNSEC to round down
+		 * MFS keeps the mtime to MTIME_NSEC_UNIT, so we round
+		 * MODNSEC down to that
 		 */
+		rip->i_mtime_nsec = fs_m_in.m_vfs_fs_utime.modnsec -
+			fs_m_in.m_vfs_fs_utime.modnsec % MTIME_NSEC_UNIT;
 		break;
 	}
 
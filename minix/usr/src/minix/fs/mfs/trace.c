@@ -0,0 +1,100 @@
+/* This file keeps the inode cache event trace.
+ *
+ * MFS handles one request at a time, so the ring needs no locking: events
+ * are added and drained by the same thread.  trace_head counts every event
+ * ever added and trace_tail the ones drained; both only grow, and the slot
+ * of event n is n modulo the ring size.
+ *
+ * The entry points into this file are
+ *   trace_add: record one event
+ *   fs_trace:  copy the events not yet drained to the caller
+ */
+
+#include "fs.h"
+#include <string.h>
+#include <minix/vfsif.h>
+#include "trace.h"
+
+/* Without INODE_TRACE no event is ever added, so keep the ring small. */
+#if INODE_TRACE
+#define TRACE_SLOTS	MFS_TRACE_SIZE
+#else
+#define TRACE_SLOTS	1
+#endif
+
+static struct mfs_trace_ev trace_ring[TRACE_SLOTS];
+static u64_t trace_head;	/* events added */
+static u64_t trace_tail;	/* events drained or lost */
+static u64_t trace_lost;	/* overwritten since the last drain */
+
+/*===========================================================================*
+ *				trace_add				     *
+ *===========================================================================*/
+void trace_add(
+  int type,			/* MFS_TR_* */
+  dev_t dev,			/* device of the inode */
+  ino_t ino			/* the inode */
+)
+{
+  struct mfs_trace_ev *ev;
+
+  ev = &trace_ring[trace_head & (TRACE_SLOTS - 1)];
+  read_tsc_64(&ev->te_time);
+  ev->te_ino = ino;
+  ev->te_dev = (u32_t) dev;
+  ev->te_type = type;
+
+  /* A full ring drops the oldest event not yet drained. */
+  if (++trace_head - trace_tail > TRACE_SLOTS) {
+	trace_tail++;
+	trace_lost++;
+  }
+}
+
+/*===========================================================================*
+ *				fs_trace				     *
+ *===========================================================================*/
+int fs_trace(void)
+{
+/* Copy a header and as many of the oldest undrained events as fit. */
+  struct mfs_trace_hdr hdr;
+  size_t len, off;
+  u64_t n;
+  unsigned int slot, chunk;
+  int r;
+
+  len = fs_m_in.m_vfs_fs_getdents.mem_size;
+  if (len < sizeof(hdr)) return(EINVAL);
+
+  n = trace_head - trace_tail;
+  if (n > (len - sizeof(hdr)) / sizeof(struct mfs_trace_ev))
+	n = (len - sizeof(hdr)) / sizeof(struct mfs_trace_ev);
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.th_seq = trace_tail;
+  hdr.th_lost = trace_lost;
+  hdr.th_count = (u32_t) n;
+
+  r = sys_safecopyto(fs_m_in.m_source, fs_m_in.m_vfs_fs_getdents.grant,
+	(vir_bytes) 0, (vir_bytes) &hdr, sizeof(hdr));
+  off = sizeof(hdr);
+
+  /* The events may wrap around the end of the ring: copy in two pieces. */
+  while (r == OK && n > 0) {
+	slot = trace_tail & (TRACE_SLOTS - 1);
+	chunk = TRACE_SLOTS - slot;
+	if (chunk > n) chunk = (unsigned int) n;
+
+	r = sys_safecopyto(fs_m_in.m_source, fs_m_in.m_vfs_fs_getdents.grant,
+		(vir_bytes) off, (vir_bytes) &trace_ring[slot],
+		chunk * sizeof(struct mfs_trace_ev));
+	off += chunk * sizeof(struct mfs_trace_ev);
+	trace_tail += chunk;
+	n -= chunk;
+  }
+  if (r != OK) return(r);
+
+  trace_lost = 0;
+  fs_m_out.m_fs_vfs_getdents.nbytes = off;
+  return(OK);
+}
@@ -0,0 +1,21 @@
+#ifndef __MFS_TRACE_H__
+#define __MFS_TRACE_H__
+
+/* Inode cache event trace: a fixed-size ring of get_inode hits and misses,
+ * evictions, write-backs, truncations and inode reads and writes, drained by
+ * REQ_MFS_TRACE.  When the ring is full the oldest events are overwritten.
+ * Tracing is compiled in only if INODE_TRACE is set in fs.h.
+ */
+
+#include <minix/mfsif.h>
+
+#if INODE_TRACE
+#define TRACE(type, dev, ino)	trace_add(type, dev, ino)
+#else
+#define TRACE(type, dev, ino)
+#endif
+
+void trace_add(int type, dev_t dev, ino_t ino);
+int fs_trace(void);
+
+#endif
@@ -0,0 +1,324 @@
+/* This file counts the owners of shared zones: zones that REQ_CLONE mapped
+ * into a second inode instead of copying them.
+ *
+ * Only zones with two or more owners are in the table; a zone that is not
+ * belongs to one inode.  An inode that may map shared zones has i_shared
+ * set, which is kept on disk in a spare bit of the NSEC_ZONE slot.  The
+ * table itself is not kept on disk.  It is built the first time it is
+ * needed, by counting the zones of every inode with i_shared set, so that
+ * a file system with no clones on it costs one pass over its inode blocks.
+ * If the table runs full while it is being built, every zone of an inode
+ * with i_shared set is taken to be shared: written zones are copied and
+ * dropped ones are leaked, but none is freed while something maps it.
+ *
+ * The entry points into this file are
+ *   zref_load:    build the table for a device if that was not done yet
+ *   zref_room:    how many more zones can be shared
+ *   zref_share:   a zone got one more owner
+ *   zref_unshare: give an inode its own copy of a zone before writing it
+ *   zref_drop:    unmap a zone from an inode, freeing it only if unshared
+ */
+
+#include "fs.h"
+#include <string.h>
+#include "buf.h"
+#include "inode.h"
+#include "super.h"
+#include "zref.h"
+
+#if ZONE_COW
+
+#define ZREF_SLOTS	65536	/* a power of two */
+#define ZREF_MAX	(ZREF_SLOTS / 4 * 3)	/* keep probe runs short */
+
+static struct zref {
+  zone_t z_zone;		/* the zone, or NO_ZONE if the slot is free */
+  unsigned int z_owners;	/* inodes that map it */
+} zref[ZREF_SLOTS];
+
+static int zref_used;		/* slots in use */
+static dev_t zref_dev = NO_DEV;	/* device the table was built for */
+static int zref_lost;		/* TRUE if the table ran full while built */
+
+static unsigned int zref_hash(zone_t z);
+static struct zref *zref_slot(zone_t z, int insert);
+static void zref_remove(struct zref *zp);
+static void zref_count(struct inode *rip);
+static void zref_prune(void);
+static int zref_release(zone_t z);
+
+/*===========================================================================*
+ *				zref_hash				     *
+ *===========================================================================*/
+static unsigned int zref_hash(zone_t z)
+{
+  return((unsigned int) (z * 2654435761U) & (ZREF_SLOTS - 1));
+}
+
+/*===========================================================================*
+ *				zref_slot				     *
+ *===========================================================================*/
+static struct zref *zref_slot(
+  zone_t z,			/* zone to look up */
+  int insert			/* TRUE to take a free slot if it is not in */
+)
+{
+/* Find the slot of zone 'z'.  A slot taken for it has no owners yet. */
+  unsigned int i;
+
+  for (i = zref_hash(z); zref[i].z_zone != NO_ZONE;
+       i = (i + 1) & (ZREF_SLOTS - 1)) {
+	if (zref[i].z_zone == z) return(&zref[i]);
+  }
+  if (!insert || zref_used >= ZREF_MAX) return(NULL);
+  zref[i].z_zone = z;
+  zref[i].z_owners = 0;
+  zref_used++;
+  return(&zref[i]);
+}
+
+/*===========================================================================*
+ *				zref_remove				     *
+ *===========================================================================*/
+static void zref_remove(struct zref *zp)
+{
+/* Free a slot, moving back the entries after it that would otherwise no
+ * longer be found from their home slot.
+ */
+  unsigned int i, j, home;
+
+  i = j = (unsigned int) (zp - zref);
+  for (;;) {
+	j = (j + 1) & (ZREF_SLOTS - 1);
+	if (zref[j].z_zone == NO_ZONE) break;
+	home = zref_hash(zref[j].z_zone);
+	if (j > i ? (home <= i || home > j) : (home <= i && home > j)) {
+		zref[i] = zref[j];
+		i = j;
+	}
+  }
+  zref[i].z_zone = NO_ZONE;
+  zref[i].z_owners = 0;
+  zref_used--;
+}
+
+/*===========================================================================*
+ *				zref_load				     *
+ *===========================================================================*/
+int zref_load(dev_t dev)
+{
+/* Build the table for 'dev' from the inodes with i_shared set, unless it
+ * has been built already.  In-core inodes are taken as they are in core.
+ */
+  struct super_block *sp;
+  struct inode *rip;
+  struct buf *bp;
+  d2_inode *dip;
+  ino_t ino, list[V2_INODES_PER_BLOCK(_MAX_BLOCK_SIZE)];
+  block_t offset;
+  int i, nr, per_block;
+
+  if (zref_dev == dev) return(OK);
+
+  memset(zref, 0, sizeof(zref));
+  zref_used = 0;
+  zref_lost = FALSE;
+
+  sp = get_super(dev);
+  per_block = V2_INODES_PER_BLOCK(sp->s_block_size);
+  offset = START_BLOCK + sp->s_imap_blocks + sp->s_zmap_blocks;
+  for (ino = 1; ino <= sp->s_ninodes; ino += per_block) {
+	/* Pick out the inodes of this block first, so that getting them
+	 * does not have to wait for the block.
+	 */
+	bp = get_block(dev, (block_t) (ino - 1) / sp->s_inodes_per_block +
+		offset, NORMAL);
+	nr = 0;
+	for (i = 0; i < per_block && ino + i <= sp->s_ninodes; i++) {
+		if ((rip = find_inode(dev, ino + i)) != NULL) {
+			if (rip->i_shared &&
+			    (rip->i_nlinks != NO_LINK || rip->i_count > 0))
+				list[nr++] = ino + i;
+			continue;
+		}
+		dip = b_v2_ino(bp) + i;
+		if (conv2(sp->s_native, dip->d2_nlinks) != NO_LINK &&
+		    (conv2(sp->s_native, dip->d2_mode) & I_TYPE) == I_REGULAR &&
+		    ((zone_t) conv4(sp->s_native, (long) dip->d2_zone[NSEC_ZONE])
+		     & ZONES_SHARED))
+			list[nr++] = ino + i;
+	}
+	put_block(bp, INODE_BLOCK);
+
+	for (i = 0; i < nr; i++) {
+		if ((rip = get_inode(dev, list[i])) == NULL) {
+			zref_lost = TRUE;	/* its zones are unknown */
+			continue;
+		}
+		zref_count(rip);
+		put_inode(rip);
+	}
+  }
+
+  zref_prune();
+  zref_dev = dev;
+  return(OK);
+}
+
+/*===========================================================================*
+ *				zref_count				     *
+ *===========================================================================*/
+static void zref_count(struct inode *rip)
+{
+/* Count 'rip' as an owner of each of its zones. */
+  struct zref *zp;
+  block_t b;
+  off_t pos;
+  int scale, zone_size;
+
+  scale = rip->i_sp->s_log_zone_size;
+  zone_size = rip->i_sp->s_block_size << scale;
+  for (pos = 0; pos < rip->i_size; pos += zone_size) {
+	if ((b = read_map(rip, pos, 0)) == NO_BLOCK) continue;
+	if ((zp = zref_slot((zone_t) (b >> scale), TRUE)) == NULL) {
+		zref_lost = TRUE;
+		return;
+	}
+	zp->z_owners++;
+  }
+}
+
+/*===========================================================================*
+ *				zref_prune				     *
+ *===========================================================================*/
+static void zref_prune(void)
+{
+/* Remove the zones that turned out to have one owner.  The pass starts at
+ * a free slot, so that no entry is moved back past it.
+ */
+  unsigned int i, n;
+
+  for (i = 0; zref[i].z_zone != NO_ZONE; i++)
+	;
+  for (n = 0; n < ZREF_SLOTS; ) {
+	if (zref[i].z_zone != NO_ZONE && zref[i].z_owners < 2) {
+		zref_remove(&zref[i]);	/* look at what moved in, too */
+		continue;
+	}
+	i = (i + 1) & (ZREF_SLOTS - 1);
+	n++;
+  }
+}
+
+/*===========================================================================*
+ *				zref_room				     *
+ *===========================================================================*/
+int zref_room(void)
+{
+  if (zref_lost) return(0);
+  return(ZREF_MAX - zref_used);
+}
+
+/*===========================================================================*
+ *				zref_share				     *
+ *===========================================================================*/
+int zref_share(
+  dev_t dev,			/* device the zone is on */
+  zone_t z			/* zone that another inode now maps too */
+)
+{
+  struct zref *zp;
+  int r;
+
+  if ((r = zref_load(dev)) != OK) return(r);
+  if (zref_lost || (zp = zref_slot(z, TRUE)) == NULL) return(ENOSPC);
+  zp->z_owners = (zp->z_owners == 0 ? 2 : zp->z_owners + 1);
+  return(OK);
+}
+
+/*===========================================================================*
+ *				zref_release				     *
+ *===========================================================================*/
+static int zref_release(zone_t z)
+{
+/* One owner of 'z' no longer maps it.  Return TRUE if that was the last. */
+  struct zref *zp;
+
+  if (zref_lost) return(FALSE);
+  if ((zp = zref_slot(z, FALSE)) == NULL) return(TRUE);
+  if (--zp->z_owners < 2) zref_remove(zp);
+  return(FALSE);
+}
+
+/*===========================================================================*
+ *				zref_unshare				     *
+ *===========================================================================*/
+int zref_unshare(
+  struct inode *rip,		/* inode about to be written */
+  off_t pos			/* position of the block to be written */
+)
+{
+/* If the zone holding 'pos' in 'rip' is shared, copy it to a new zone and
+ * map that in its place, so that the other owners keep the data as it is.
+ */
+  struct super_block *sp;
+  struct buf *sbp, *dbp;
+  block_t b, ob, nb;
+  zone_t z, nz;
+  int i, r, scale, zone_size;
+
+  if (!rip->i_shared) return(OK);
+  if ((r = zref_load(rip->i_dev)) != OK) return(r);
+
+  sp = rip->i_sp;
+  scale = sp->s_log_zone_size;
+  zone_size = sp->s_block_size << scale;
+  pos -= pos % zone_size;
+  if ((b = read_map(rip, pos, 0)) == NO_BLOCK) return(OK);	/* a hole */
+  z = (zone_t) (b >> scale);
+  if (!zref_lost && zref_slot(z, FALSE) == NULL) return(OK);	/* its own */
+
+  if ((nz = alloc_zone(rip->i_dev, z)) == NO_ZONE) return(err_code);
+  ob = (block_t) z << scale;
+  nb = (block_t) nz << scale;
+  for (i = 0; i < (1 << scale); i++) {
+	sbp = get_block(rip->i_dev, ob + i, NORMAL);
+	dbp = get_block(rip->i_dev, nb + i, NO_READ);
+	memcpy(b_data(dbp), b_data(sbp), (size_t) sp->s_block_size);
+	MARKDIRTY(dbp);
+	put_block(sbp, FULL_DATA_BLOCK);
+	put_block(dbp, FULL_DATA_BLOCK);
+  }
+  if ((r = write_map(rip, pos, nz, 0)) != OK) {
+	free_zone(rip->i_dev, nz);
+	return(r);
+  }
+  (void) zref_release(z);
+  return(OK);
+}
+
+/*===========================================================================*
+ *				zref_drop				     *
+ *===========================================================================*/
+int zref_drop(
+  struct inode *rip,		/* inode a zone is being freed from */
+  off_t pos			/* position in the zone */
+)
+{
+/* Called before write_map(rip, pos, NO_ZONE, WMAP_FREE).  If other inodes
+ * still map the zone, unmap it here without freeing it, so that write_map()
+ * only frees the indirect blocks left empty.
+ */
+  block_t b;
+  int r;
+
+  if (!rip->i_shared) return(OK);
+  if ((r = zref_load(rip->i_dev)) != OK) return(r);
+
+  if ((b = read_map(rip, pos, 0)) == NO_BLOCK) return(OK);
+  if (zref_release((zone_t) (b >> rip->i_sp->s_log_zone_size)))
+	return(OK);			/* the last owner: write_map frees it */
+  return(write_map(rip, pos, NO_ZONE, 0));
+}
+
+#endif /* ZONE_COW */
@@ -0,0 +1,31 @@
+#ifndef __MFS_ZREF_H__
+#define __MFS_ZREF_H__
+
+/* Shared zones: REQ_CLONE makes a new inode that maps the zones of a file
+ * instead of copying them.  Such zones have more than one owner, which the
+ * table in zref.c counts, and are given a copy of their own by the owner
+ * that first writes to them.  See zref.c.
+ *
+ * Every block written in place must go through zref_unshare() first if its
+ * inode has i_shared set; link.c does so for the blocks it zeroes, and
+ * rw_chunk() in read.c has to for the blocks it writes.  All of this is
+ * compiled in only if ZONE_COW is set in fs.h; without it no zone is ever
+ * shared and the hooks cost nothing.  fsck.mfs takes a shared zone for a
+ * zone claimed twice, and the i_shared bit for a triple indirect zone (see
+ * NSEC_ZONE in inode.h), so ZONE_COW stays off until it knows both.
+ */
+
+#if ZONE_COW
+struct inode;
+
+int zref_load(dev_t dev);
+int zref_room(void);
+int zref_share(dev_t dev, zone_t z);
+int zref_unshare(struct inode *rip, off_t pos);
+int zref_drop(struct inode *rip, off_t pos);
+#else
+#define zref_unshare(rip, pos)	(OK)
+#define zref_drop(rip, pos)	(OK)
+#endif
+
+#endif
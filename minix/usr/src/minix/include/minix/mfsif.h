@@ -0,0 +1,238 @@
+#ifndef _MINIX_MFSIF_H
+#define _MINIX_MFSIF_H
+
+/* Layouts of the data passed through grants by the MFS-specific requests
+ * that do not fit in a message.  VFS and the tools using these requests
+ * share them with MFS.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <minix/vfsif.h>
+
+#define MFSIF_NAME_MAX		60	/* MFS_NAME_MAX of the file system */
+
+/* The requests below are numbered on from the last one of <minix/vfsif.h>;
+ * MFS_NREQS counts both kinds, and is the size of MFS's fs_call_vec.
+ */
+#define MFS_NREQS		(NREQS + 10)
+
+/* REQ_RENAME flags, with the values renameat2() uses elsewhere.  The
+ * m_vfs_fs_rename layout has no field for them, so they travel in the first
+ * byte of its padding.  VFS clears its messages before filling them in, which
+ * leaves zero, a plain rename, unless it sets the flags.
+ */
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE	(1 << 0)	/* fail with EEXIST if 'new' exists */
+#endif
+#ifndef RENAME_EXCHANGE
+#define RENAME_EXCHANGE		(1 << 1)	/* atomically swap 'old' and 'new' */
+#endif
+#define MFS_RENAME_FLAGS(m)	((m)->m_vfs_fs_rename.data[0])
+
+/* REQ_LINK_BATCH: create many hard links to one inode.  The request uses the
+ * m_vfs_fs_link layout: 'inode' is the file to link to, 'grant' and
+ * 'path_len' describe an array of the targets below.  MFS fills in the
+ * status of every target and copies the array back.
+ */
+#define REQ_LINK_BATCH		(FS_BASE + NREQS + 0)
+
+#define MFS_LINK_BATCH_MAX	64	/* targets per request */
+
+struct mfs_link_target {
+	ino_t lt_dir;			/* directory to create the link in */
+	char lt_name[MFSIF_NAME_MAX];	/* name of the link, NUL padded */
+	int lt_status;			/* OK or why the link was not made */
+};
+
+/* REQ_STAT_BATCH: stat many inodes at once.  The request uses the
+ * m_vfs_fs_getdents layout: 'grant' and 'mem_size' describe an array of the
+ * entries below with se_ino filled in.  MFS fills in the rest and copies the
+ * array back.
+ */
+#define REQ_STAT_BATCH		(FS_BASE + NREQS + 1)
+
+#define MFS_STAT_BATCH_MAX	32	/* entries per request */
+
+struct mfs_stat_ent {
+	ino_t se_ino;			/* inode to stat */
+	int se_status;			/* OK or why se_stat is not valid */
+	struct stat se_stat;		/* result */
+};
+
+/* REQ_GETDENTS_PLUS: read directory entries together with the attributes of
+ * the inodes they refer to.  The request and reply use the getdents layouts:
+ * 'inode' is the directory, 'seek_pos' a multiple of the on-disk entry size
+ * to start at, and 'grant' and 'mem_size' describe an array of the records
+ * below.  The reply gives the position to continue at and the number of
+ * bytes filled in.
+ */
+#define REQ_GETDENTS_PLUS	(FS_BASE + NREQS + 2)
+
+struct mfs_dirent_plus {
+	char dp_name[MFSIF_NAME_MAX + 1];	/* NUL terminated entry name */
+	int dp_status;			/* OK or why dp_stat is not valid */
+	struct stat dp_stat;		/* attributes, dp_stat.st_ino included */
+};
+
+/* REQ_STATX: stat only the fields asked for.  The request uses the
+ * m_vfs_fs_stat layout; 'grant' refers to a struct mfs_statx with sx_mask
+ * set.  Fields are laid out in mask bit order and MFS copies the struct back
+ * only up to the last field asked for, so cheap queries stay cheap: asking
+ * for no time skips the time update, asking for no block count skips its
+ * estimate.
+ */
+#define REQ_STATX		(FS_BASE + NREQS + 3)
+
+#define MFS_STATX_SIZE		0x001
+#define MFS_STATX_MTIME		0x002
+#define MFS_STATX_MODE		0x004
+#define MFS_STATX_NLINK		0x008
+#define MFS_STATX_UID		0x010
+#define MFS_STATX_GID		0x020
+#define MFS_STATX_ATIME		0x040
+#define MFS_STATX_CTIME		0x080
+#define MFS_STATX_BLOCKS	0x100
+#define MFS_STATX_ALL		0x1ff
+
+struct mfs_statx {
+	u_int32_t sx_mask;		/* in: fields wanted; out: filled in */
+	off_t sx_size;
+	time_t sx_mtime;
+	long sx_mtime_nsec;
+	mode_t sx_mode;
+	nlink_t sx_nlink;
+	uid_t sx_uid;
+	gid_t sx_gid;
+	time_t sx_atime;
+	time_t sx_ctime;
+	long sx_ctime_nsec;
+	blkcnt_t sx_blocks;
+};
+
+/* REQ_MFS_STATS: copy out the per-request statistics.  The request and reply
+ * use the getdents layouts: 'grant' and 'mem_size' describe an array of
+ * MFS_STATS_ENTRIES of the structs below, indexed by request number minus
+ * FS_BASE.  The last entry times the deletion mode lookup of unlink.  All
+ * counts stay zero unless MFS is built with REQ_STATS, and the per-request
+ * ones are only kept by the host build, whose mfs_host_request() dispatches
+ * through req_stats_call().  If 'mem_size' leaves room, a struct
+ * mfs_name_stat follows the array; its counts are always kept.
+ */
+#define REQ_MFS_STATS		(FS_BASE + NREQS + 4)
+
+#define MFS_STATS_BUCKETS	32		/* rs_hist[i]: 2^i cycles */
+#define MFS_STATS_MODE		MFS_NREQS	/* getCurrentMode() entry */
+#define MFS_STATS_ENTRIES	(MFS_NREQS + 1)
+
+struct mfs_req_stat {
+	u_int64_t rs_calls;		/* times handled */
+	u_int64_t rs_errors;		/* times it did not return OK */
+	u_int64_t rs_cycles;		/* total TSC cycles taken */
+	u_int32_t rs_hist[MFS_STATS_BUCKETS];	/* latency histogram */
+};
+
+struct mfs_name_stat {
+	u_int64_t ns_hits;		/* name found in the name cache */
+	u_int64_t ns_neg_hits;		/* name known missing from the cache */
+	u_int64_t ns_misses;		/* directory scanned */
+	u_int64_t ns_evictions;		/* entries pushed out of a full set */
+};
+
+/* REQ_MFS_TRACE: drain the inode cache event trace.  The request and reply
+ * use the getdents layouts: 'grant' and 'mem_size' describe a buffer that
+ * MFS fills with a struct mfs_trace_hdr followed by th_count events, oldest
+ * first, and 'nbytes' says how much of it was used.  Events drained once are
+ * not returned again.  The trace stays empty unless MFS is built with
+ * INODE_TRACE.
+ */
+#define REQ_MFS_TRACE		(FS_BASE + NREQS + 5)
+
+#define MFS_TRACE_SIZE		65536	/* events kept, a power of two */
+
+#define MFS_TR_HIT		1	/* get_inode found the inode cached */
+#define MFS_TR_MISS		2	/* get_inode read the inode in */
+#define MFS_TR_EVICT		3	/* an unused inode lost its slot */
+#define MFS_TR_WRITEBACK	4	/* put_inode wrote a dirty inode */
+#define MFS_TR_TRUNC		5	/* truncate_inode */
+#define MFS_TR_READ		6	/* rw_inode read */
+#define MFS_TR_WRITE		7	/* rw_inode write */
+
+struct mfs_trace_hdr {
+	u_int64_t th_seq;		/* sequence number of the first event */
+	u_int64_t th_lost;		/* overwritten before they were drained */
+	u_int32_t th_count;		/* events that follow */
+	u_int32_t th_pad;
+};
+
+struct mfs_trace_ev {
+	u_int64_t te_time;		/* TSC cycles */
+	u_int64_t te_ino;		/* inode number */
+	u_int32_t te_dev;		/* device */
+	u_int32_t te_type;		/* MFS_TR_* */
+};
+
+/* REQ_MFS_COMPACT: pack the entries of a directory to the front, keeping
+ * their order, and free the blocks left empty behind them.  The request uses
+ * the m_vfs_fs_ftrunc layout with only 'inode', the directory, set.  Entries
+ * move, so directory positions returned by getdents before the request are
+ * not valid after it.  The moves are not journaled, so with the journal on
+ * the request fails with EBUSY.
+ */
+#define REQ_MFS_COMPACT		(FS_BASE + NREQS + 6)
+
+/* REQ_RMTREE: remove a file or a whole directory tree.  The request and
+ * reply use the getdents layouts: 'inode' is the directory holding the tree,
+ * 'grant' and 'mem_size' describe the struct below with rt_name filled in.
+ * MFS removes the tree depth first, applying the deletion mode of each
+ * directory to the files in it as unlink would, fills in the rest of the
+ * struct and copies it back.  Directories in use (open, or somebody's working
+ * directory) and mount points are left in place with EBUSY.  A walk that
+ * has kept MFS_RMTREE_KEPT_MAX files under a mode C .bak name leaves the
+ * rest in place with ENOSPC.
+ */
+#define REQ_RMTREE		(FS_BASE + NREQS + 7)
+
+#define MFS_RMTREE_KEPT_MAX	1023	/* .bak files one walk keeps */
+
+struct mfs_rmtree {
+	char rt_name[MFSIF_NAME_MAX];	/* name of the tree, NUL padded */
+	u_int32_t rt_removed;		/* files and directories removed */
+	u_int32_t rt_kept;		/* files the deletion modes kept */
+	u_int32_t rt_failed;		/* entries not removed for an error */
+	int rt_error;			/* the first such error, or OK */
+	ino_t rt_error_ino;		/* and the inode it happened to */
+};
+
+/* REQ_COPYTREE: copy a file or a whole directory tree within the file
+ * system.  The request and reply use the getdents layouts: 'inode' is the
+ * directory holding the tree, 'grant' and 'mem_size' describe the struct
+ * below with the first three fields filled in.  The copy is made under a new
+ * name and may not be inside the tree.  Attributes are kept, except for the
+ * mark of a file deleted once in mode B.  Files linked more than once are
+ * copied once per name.  Mount points are left out with EBUSY.
+ */
+#define REQ_COPYTREE		(FS_BASE + NREQS + 8)
+
+struct mfs_copytree {
+	ino_t ct_dst_dir;		/* directory to make the copy in */
+	char ct_src_name[MFSIF_NAME_MAX];	/* name of the tree, NUL padded */
+	char ct_dst_name[MFSIF_NAME_MAX];	/* name of the copy, NUL padded */
+	u_int32_t ct_copied;		/* files and directories copied */
+	u_int32_t ct_failed;		/* entries not copied */
+	u_int64_t ct_blocks;		/* data blocks copied */
+	int ct_error;			/* the first error, or OK */
+	ino_t ct_error_ino;		/* and the inode it happened to */
+};
+
+/* REQ_CLONE: make a new regular file that shares the data of another
+ * instead of copying it.  The request uses the m_vfs_fs_link layout, as
+ * REQ_LINK does: 'inode' is the file, 'dir_ino', 'grant' and 'path_len' give
+ * the directory and name of the clone.  The two share their zones until one
+ * of them writes to a zone, which then gets a copy of its own.  Attributes
+ * are kept as REQ_COPYTREE keeps them.  MFS built without ZONE_COW answers
+ * ENOSYS.
+ */
+#define REQ_CLONE		(FS_BASE + NREQS + 9)
+
+#endif /* _MINIX_MFSIF_H */